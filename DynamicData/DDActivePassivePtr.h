@@ -59,6 +59,7 @@ public:
     const DDActivePassivePtr& operator=(const DDActivePassivePtr&) = delete;
     
     PtrObj* operator->() { return &_activeObj; }
+    PtrObj& operator*() { return _activeObj; }
     
     PtrObj&  back() { return _passiveObj; }
     
@@ -147,11 +147,43 @@ private:
     
 public:
     
-    DDBaseSet() :
-        _halfWindowWidth(WindowWidth / 2.0)
+    class WalkStats
     {
+    public:
+        WalkStats() : adjustCount(0), baseWalk(0), leafWalk(0) {}
+        
+        //number of adjustNodesImp calls.
+        size_t adjustCount;
+        
+        //base and leaf nodes touched by all the adjustNodesImp calls.
+        size_t baseWalk;
+        size_t leafWalk;
+    };
+    
+    //WindowWidth is only the initial bucket width, it can be changed at runtime.
+    DDBaseSet(IdxType windowWidth = WindowWidth)
+    {
+        setWindowWidth(windowWidth);
         initBaseSet();
     }
+    
+    void setWindowWidth(IdxType windowWidth)
+    {
+        assert(windowWidth >= 2);
+        
+        _windowWidth = windowWidth;
+        _halfWindowWidth = windowWidth / 2.0;
+    }
+    
+    IdxType windowWidth() const
+    {
+        return _windowWidth;
+    }
+    
+    const WalkStats& walkStats() const
+    {
+        return _walkStats;
+    }
             
     void insert(LeafSetPtr insertPtr, IdxType idx, const Element& element) = delete;
     
@@ -175,7 +207,7 @@ public:
         }
         
         //check if we have to insert a new BaseElement.
-        if (basePtr->leafElemCount() > WindowWidth)
+        if (basePtr->leafElemCount() > _windowWidth)
         {
             auto windowSearchItr = insertPtr;
             if (insertPtr == _leafSet.end()) windowSearchItr--;
@@ -274,6 +306,7 @@ public:
     {
         initBaseSet();
         _leafSet.clear();
+        _walkStats = WalkStats();
     }
     
     //
@@ -297,8 +330,11 @@ private:
     LeafSetType _leafSet;
     BaseContainer _baseSet;
     
+    IdxType _windowWidth;
     IdxType _halfWindowWidth;
     
+    WalkStats _walkStats;
+    
     void initBaseSet()
     {
         _baseSet.clear();
@@ -313,15 +349,21 @@ private:
         {
             currBasePtr->adjust();
             currBasePtr++;
+            
+            _walkStats.baseWalk++;
         }
         
         //adjust the leaf elements.
         auto currPtr = leafPtr;
-        while(currPtr->basePtr() == leafPtrsBasePtr)
+        while(currPtr != _leafSet.end() && currPtr->basePtr() == leafPtrsBasePtr)
         {
             currPtr->adjust();
             currPtr++;
+            
+            _walkStats.leafWalk++;
         }
+        
+        _walkStats.adjustCount++;
     }
 };
             
@@ -312,12 +312,44 @@ private:
     
 public:
     
-    DDBaseVec() :
-    _halfWindowWidth(WindowWidth / 2.0)
+    class WalkStats
     {
+    public:
+        WalkStats() : adjustCount(0), baseWalk(0), leafWalk(0) {}
+        
+        //number of adjustNodesImp calls.
+        size_t adjustCount;
+        
+        //base and leaf nodes touched by all the adjustNodesImp calls.
+        size_t baseWalk;
+        size_t leafWalk;
+    };
+    
+    //WindowWidth is only the initial bucket width, it can be changed at runtime.
+    DDBaseVec(IdxType windowWidth = WindowWidth)
+    {
+        setWindowWidth(windowWidth);
         initBaseSet();
     }
     
+    void setWindowWidth(IdxType windowWidth)
+    {
+        assert(windowWidth >= 2);
+        
+        _windowWidth = windowWidth;
+        _halfWindowWidth = windowWidth / 2.0;
+    }
+    
+    IdxType windowWidth() const
+    {
+        return _windowWidth;
+    }
+    
+    const WalkStats& walkStats() const
+    {
+        return _walkStats;
+    }
+    
     DDBaseVec(const DDBaseVec&) = delete;
     const DDBaseVec& operator=(const DDBaseVec&) = delete;
     
@@ -339,7 +371,7 @@ public:
         bool hasNewBaseElement = false;
         
         //check if we have to insert a new BaseElement.
-        if (basePtr->leafElemCount() >= WindowWidth)
+        if (basePtr->leafElemCount() >= _windowWidth)
         {
             //std::cout << "__new base " << std::endl;
             
@@ -456,6 +488,7 @@ public:
         _leafSet.clear();
         
         initBaseSet();
+        _walkStats = WalkStats();
     }
     
     //
@@ -482,8 +515,11 @@ private:
     BaseContainer _baseContainer;
     BaseElementHandles _baseElementHandles;
     
+    IdxType _windowWidth;
     IdxType _halfWindowWidth;
     
+    WalkStats _walkStats;
+    
     void initBaseSet()
     {
         _baseElementHandles.clear();
@@ -516,6 +552,8 @@ private:
             }
             
             currBasePtr++;
+            
+            _walkStats.baseWalk++;
         }
         
         //adjust the leaf elements.
@@ -524,7 +562,11 @@ private:
         {
             currPtr->adjust();
             currPtr++;
+            
+            _walkStats.leafWalk++;
         }
+        
+        _walkStats.adjustCount++;
     }
 };
 
@@ -0,0 +1,211 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDBaselines_h
+#define DynamicData_DDBaselines_h
+
+#include <vector>
+#include <cstdint>
+
+#ifdef __GLIBCXX__
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#endif
+
+#include "DDIndex.h"
+#include "DDCountedBTree.h"
+
+/*
+ * Positional containers with the interface of DDIndex (get, insertIdx, deleteIdx, size) for the
+ * baseline comparison benchmark. append fills them, flush finishes pending work and memoryBytes
+ * reports the size of the structure.
+ */
+
+//shifts on every insert and delete.
+template<typename IdxType, typename YType>
+class DDVectorBaseline
+{
+public:
+    
+    static const char* name() { return "vector"; }
+    
+    YType get(IdxType idx) { return _values[idx]; }
+    
+    void insertIdx(IdxType idx, YType yValue) { _values.insert(_values.begin() + idx, yValue); }
+    void deleteIdx(IdxType idx) { _values.erase(_values.begin() + idx); }
+    void append(YType yValue) { _values.push_back(yValue); }
+    
+    IdxType size() { return (IdxType)_values.size(); }
+    
+    void flush() {}
+    
+    size_t memoryBytes() { return _values.capacity() * sizeof(YType); }
+    
+private:
+    std::vector<YType> _values;
+};
+
+#ifdef __GLIBCXX__
+
+/*
+ * pb_ds order statistic tree. The keys are labels with gaps, an insert takes the middle of its
+ * neighbours and relabels the whole tree once they are adjacent. Uniform positions rarely
+ * relabel, inserting at the same position does every 20 inserts.
+ */
+template<typename IdxType, typename YType>
+class DDOrderStatTreeBaseline
+{
+public:
+    
+    static const char* name() { return "pbds_tree"; }
+    
+    YType get(IdxType idx) { return _tree.find_by_order(idx)->second; }
+    
+    void insertIdx(IdxType idx, YType yValue)
+    {
+        uint64_t key = 0;
+        
+        if (!freeKey(idx, key))
+        {
+            relabel();
+            freeKey(idx, key);
+        }
+        
+        _tree.insert(std::make_pair(key, yValue));
+    }
+    
+    void deleteIdx(IdxType idx) { _tree.erase(_tree.find_by_order(idx)); }
+    
+    void append(YType yValue)
+    {
+        uint64_t key = _tree.empty() ? Gap : _tree.rbegin()->first + Gap;
+        _tree.insert(std::make_pair(key, yValue));
+    }
+    
+    IdxType size() { return (IdxType)_tree.size(); }
+    
+    void flush() {}
+    
+    //estimate, a red black node with the size of its subtree plus the key and the value.
+    size_t memoryBytes() { return _tree.size() * (sizeof(typename Tree::value_type) + 3 * sizeof(void*) + 2 * sizeof(size_t)); }
+    
+private:
+    static const uint64_t Gap = 1ULL << 20;
+    
+    typedef __gnu_pbds::tree<uint64_t, YType, std::less<uint64_t>, __gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update> Tree;
+    
+    Tree _tree;
+    
+    bool freeKey(IdxType idx, uint64_t& key)
+    {
+        uint64_t lower = idx == 0 ? 0 : _tree.find_by_order(idx - 1)->first;
+        uint64_t upper = idx == _tree.size() ? lower + 2 * Gap : _tree.find_by_order(idx)->first;
+        
+        if (upper - lower < 2) return false;
+        
+        key = lower + (upper - lower) / 2;
+        return true;
+    }
+    
+    void relabel()
+    {
+        Tree tree;
+        uint64_t key = Gap;
+        
+        for (auto itr = _tree.begin(); itr != _tree.end(); itr++)
+        {
+            tree.insert(std::make_pair(key, itr->second));
+            key += Gap;
+        }
+        
+        _tree.swap(tree);
+    }
+};
+
+#endif
+
+template<typename IdxType, typename YType>
+class DDCountedBTreeBaseline
+{
+public:
+    
+    static const char* name() { return "counted_btree"; }
+    
+    YType get(IdxType idx) { return _tree.get(idx); }
+    
+    void insertIdx(IdxType idx, YType yValue) { _tree.insert(idx, yValue); }
+    void deleteIdx(IdxType idx) { _tree.erase(idx); }
+    void append(YType yValue) { _tree.insert(_tree.size(), yValue); }
+    
+    IdxType size() { return (IdxType)_tree.size(); }
+    
+    void flush() {}
+    
+    size_t memoryBytes() { return _tree.memoryBytes(); }
+    
+private:
+    DDCountedBTree<YType> _tree;
+};
+
+//a DDIndex of its own, the files are removed when it goes away.
+template<typename IdxType, typename YType>
+class DDIndexBaseline
+{
+public:
+    
+    DDIndexBaseline() : _ddIndex(3, 0, 1, 2) {}
+    
+    ~DDIndexBaseline()
+    {
+        _ddIndex.unpersist();
+    }
+    
+    DDIndexBaseline(const DDIndexBaseline&) = delete;
+    const DDIndexBaseline& operator=(const DDIndexBaseline&) = delete;
+    
+    static const char* name() { return "ddindex"; }
+    
+    YType get(IdxType idx) { return _ddIndex.get(idx); }
+    
+    void insertIdx(IdxType idx, YType yValue) { _ddIndex.insertIdx(idx, yValue); }
+    void deleteIdx(IdxType idx) { _ddIndex.deleteIdx(idx); }
+    void append(YType yValue) { _ddIndex.insertIdx(_ddIndex.size(), yValue); }
+    
+    IdxType size() { return _ddIndex.size(); }
+    
+    void flush() { _ddIndex.flush(); }
+    
+    //the mapped files.
+    size_t memoryBytes() { return _ddIndex.storageBytes(); }
+    
+private:
+    DDIndex<IdxType, YType> _ddIndex;
+};
+
+#endif
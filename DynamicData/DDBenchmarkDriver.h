@@ -0,0 +1,518 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDBenchmarkDriver_h
+#define DynamicData_DDBenchmarkDriver_h
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "DDBenchmarks.h"
+
+/*
+ * Command line front end of DDBenchmarkRunner, e.g.
+ *
+ *   DDBenchmark --index-size 100000 --value-size 64 --benchmarks RandomReadBenchmark --json results.json
+ *
+ * Without --json the results are printed as text, with --json - only the json goes to stdout.
+ * --record-trace and --replay-trace write and replay a DDOpTrace instead of running the benchmarks.
+ */
+class DDBenchmarkDriver
+{
+public:
+    
+    typedef unsigned int IdxType;
+    
+    class TraceOptions
+    {
+    public:
+        TraceOptions() : operations(1000000), recordedSpeed(false), traits("default") {}
+        
+        std::string recordPath;
+        std::string replayPath;
+        
+        //spans of the merges, needs DD_TRACING.
+        std::string chromeTracePath;
+        size_t operations;
+        bool recordedSpeed;
+        
+        //default, direct, journaled, staged or shared.
+        std::string traits;
+    };
+    
+    static int run(int argc, const char* argv[])
+    {
+        DDBenchmarkConfig config;
+        TraceOptions trace;
+        std::string jsonPath;
+        bool assertValues = false;
+        
+        if (!parse(argc, argv, config, trace, jsonPath, assertValues))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        
+        if (config.randomReadWidth > config.indexSize) config.randomReadWidth = config.indexSize;
+        
+        if (config.workload.zipfTheta <= 0 || config.workload.zipfTheta >= 1)
+        {
+            std::cout << "DDBenchmarkDriver: --zipf-theta has to be in (0, 1)" << std::endl;
+            return 1;
+        }
+        
+        if (config.workload.readPercent + config.workload.insertPercent > 100)
+        {
+            std::cout << "DDBenchmarkDriver: --read-percent and --insert-percent add up to more than 100" << std::endl;
+            return 1;
+        }
+        
+        //the benchmarks reuse the index files, start from an empty store.
+        system("rm -rf data");
+        
+        DDRandomGen<IdxType>::seed(config.seed);
+        DDRandomGen<unsigned int>::seed(config.seed);
+        
+        bool printText = jsonPath != "-";
+        std::vector<DDBenchmarkResult> results;
+        
+        if (!trace.chromeTracePath.empty()) DDTraceEvents::SHARED()->start(trace.chromeTracePath);
+        
+        bool done;
+        
+        if (!trace.recordPath.empty() || !trace.replayPath.empty())
+        {
+            done = runTrace(config, trace, printText, results);
+        }
+        else
+        {
+            if (assertValues) done = runValueSize<true>(config, printText, results);
+            else done = runValueSize<false>(config, printText, results);
+            
+            if (!done) std::cout << "DDBenchmarkDriver: unsupported value size " << config.valueSize << std::endl;
+        }
+        
+        if (!trace.chromeTracePath.empty()) DDTraceEvents::SHARED()->stop();
+        
+        if (!done) return 1;
+        
+        return writeResults(jsonPath, config, results);
+    }
+    
+private:
+    
+    static int writeResults(const std::string& jsonPath, const DDBenchmarkConfig& config, const std::vector<DDBenchmarkResult>& results)
+    {
+        if (jsonPath.empty()) return 0;
+        
+        if (jsonPath == "-")
+        {
+            writeJson(std::cout, config, results);
+        }
+        else
+        {
+            std::ofstream file(jsonPath.c_str(), std::ios::trunc);
+            
+            if (!file)
+            {
+                std::cout << "DDBenchmarkDriver: error opening " << jsonPath << std::endl;
+                return 1;
+            }
+            
+            writeJson(file, config, results);
+        }
+        
+        return 0;
+    }
+    
+    static void usage(const char* name)
+    {
+        std::cout << "usage: " << name << " [options]" << std::endl;
+        std::cout << "  --index-size N                 elements of the index" << std::endl;
+        std::cout << "  --value-size B                 bytes per value: 8, 16, 32, 64, 128, 256, 512 or 1024" << std::endl;
+        std::cout << "  --random-reads N" << std::endl;
+        std::cout << "  --random-read-width N" << std::endl;
+        std::cout << "  --sequential-reads N" << std::endl;
+        std::cout << "  --sequential-writes N" << std::endl;
+        std::cout << "  --random-writes N" << std::endl;
+        std::cout << "  --random-delete-writes N" << std::endl;
+        std::cout << "  --latency-sample-rate N        time every N-th operation" << std::endl;
+        std::cout << "  --ops-per-thread N             concurrent benchmark" << std::endl;
+        std::cout << "  --min-threads N" << std::endl;
+        std::cout << "  --max-threads N" << std::endl;
+        std::cout << "  --writer-percent N" << std::endl;
+        std::cout << "  --lock-read-percent N          gets of the lock policy benchmark" << std::endl;
+        std::cout << "  --merge-insert-percent N       merge benchmark" << std::endl;
+        std::cout << "  --merge-write-rate N" << std::endl;
+        std::cout << "  --merge-write-seconds N" << std::endl;
+        std::cout << "  --baseline-sizes A,B,..        baseline comparison, e.g. 10000,100000,1000000" << std::endl;
+        std::cout << "  --baseline-ops N               ops per phase and structure" << std::endl;
+        std::cout << "  --baseline-seconds N           time limit per phase and structure" << std::endl;
+        std::cout << "  --distribution NAME            positions: uniform, zipfian, hotspot, latest or sequential" << std::endl;
+        std::cout << "  --zipf-theta X                 skew of zipfian and latest, 0 < X < 1" << std::endl;
+        std::cout << "  --hotspot-fraction X           share of the index which is hot" << std::endl;
+        std::cout << "  --hotspot-op-fraction X        share of the operations which hit it" << std::endl;
+        std::cout << "  --hotspot-start X              start of the hot region, 0 is the top" << std::endl;
+        std::cout << "  --read-percent N               operation mix of --record-trace, the rest are deletes" << std::endl;
+        std::cout << "  --insert-percent N" << std::endl;
+        std::cout << "  --seed N" << std::endl;
+        std::cout << "  --rounds N                     0 runs every selected benchmark once" << std::endl;
+        std::cout << "  --benchmarks A,B,..            e.g. RandomReadBenchmark,MergeThroughputBenchmark" << std::endl;
+        std::cout << "  --assert                       check the index against a reference model" << std::endl;
+        std::cout << "  --json PATH                    write the results as json, - for stdout" << std::endl;
+        std::cout << "  --record-trace PATH            trace --index-size inserts and --trace-ops ops of the workload" << std::endl;
+        std::cout << "  --trace-ops N" << std::endl;
+        std::cout << "  --replay-trace PATH            replay a trace against a fresh index, the value size comes from the trace" << std::endl;
+        std::cout << "  --replay-speed S               max or recorded" << std::endl;
+        std::cout << "  --replay-traits T              default, direct (values up to 16 bytes), journaled, staged or shared" << std::endl;
+        std::cout << "  --chrome-trace PATH            write the merge spans as chrome trace events, needs -DDD_TRACING" << std::endl;
+        std::cout << "note: removes ./data before running." << std::endl;
+    }
+    
+    static bool parseNumber(const char* arg, size_t& value)
+    {
+        char* end;
+        unsigned long long number = std::strtoull(arg, &end, 10);
+        
+        if (end == arg || *end != '\0') return false;
+        
+        value = (size_t)number;
+        return true;
+    }
+    
+    static bool parseDouble(const char* arg, double& value)
+    {
+        char* end;
+        double number = std::strtod(arg, &end);
+        
+        if (end == arg || *end != '\0') return false;
+        
+        value = number;
+        return true;
+    }
+    
+    //comma separated, empty parts are skipped.
+    static std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> parts;
+        size_t start = 0;
+        
+        while (start <= list.size())
+        {
+            size_t end = list.find(',', start);
+            if (end == std::string::npos) end = list.size();
+            
+            if (end > start) parts.push_back(list.substr(start, end - start));
+            
+            start = end + 1;
+        }
+        
+        return parts;
+    }
+    
+    static bool parse(int argc, const char* argv[], DDBenchmarkConfig& config, TraceOptions& trace, std::string& jsonPath, bool& assertValues)
+    {
+        size_t readPercent = config.workload.readPercent;
+        size_t insertPercent = config.workload.insertPercent;
+        
+        std::vector<std::pair<std::string, size_t*>> numbers =
+        {
+            {"--index-size", &config.indexSize},
+            {"--value-size", &config.valueSize},
+            {"--random-reads", &config.randomReads},
+            {"--random-read-width", &config.randomReadWidth},
+            {"--sequential-reads", &config.sequentialReads},
+            {"--sequential-writes", &config.sequentialWrites},
+            {"--random-writes", &config.randomWrites},
+            {"--random-delete-writes", &config.randomDeleteWrites},
+            {"--latency-sample-rate", &config.latencySampleRate},
+            {"--ops-per-thread", &config.concurrentOpsPerThread},
+            {"--min-threads", &config.concurrentMinThreads},
+            {"--max-threads", &config.concurrentMaxThreads},
+            {"--writer-percent", &config.concurrentWriterPercent},
+            {"--lock-read-percent", &config.lockReadPercent},
+            {"--merge-insert-percent", &config.mergeInsertPercent},
+            {"--merge-write-rate", &config.mergeWriteRate},
+            {"--merge-write-seconds", &config.mergeWriteSeconds},
+            {"--baseline-ops", &config.baselineOps},
+            {"--baseline-seconds", &config.baselineSeconds},
+            {"--rounds", &config.rounds},
+            {"--read-percent", &readPercent},
+            {"--insert-percent", &insertPercent},
+            {"--trace-ops", &trace.operations}
+        };
+        
+        std::vector<std::pair<std::string, double*>> fractions =
+        {
+            {"--zipf-theta", &config.workload.zipfTheta},
+            {"--hotspot-fraction", &config.workload.hotspotFraction},
+            {"--hotspot-op-fraction", &config.workload.hotspotOpFraction},
+            {"--hotspot-start", &config.workload.hotspotStart}
+        };
+        
+        for (int i=1; i<argc; i++)
+        {
+            std::string arg = argv[i];
+            
+            if (arg == "--assert")
+            {
+                assertValues = true;
+                continue;
+            }
+            
+            if (i + 1 >= argc) return false;
+            
+            const char* value = argv[++i];
+            bool found = false;
+            
+            for (auto itr = numbers.begin(); itr != numbers.end(); itr++)
+            {
+                if (itr->first != arg) continue;
+                
+                if (!parseNumber(value, *itr->second)) return false;
+                found = true;
+            }
+            
+            for (auto itr = fractions.begin(); itr != fractions.end(); itr++)
+            {
+                if (itr->first != arg) continue;
+                
+                if (!parseDouble(value, *itr->second)) return false;
+                found = true;
+            }
+            
+            if (found) continue;
+            
+            if (arg == "--seed")
+            {
+                size_t seed;
+                if (!parseNumber(value, seed)) return false;
+                
+                config.seed = (unsigned int)seed;
+            }
+            else if (arg == "--distribution")
+            {
+                if (!DDWorkloadGen::parseDistribution(value, config.workload.distribution)) return false;
+            }
+            else if (arg == "--benchmarks")
+            {
+                std::vector<std::string> names = split(value);
+                config.benchmarks.insert(config.benchmarks.end(), names.begin(), names.end());
+            }
+            else if (arg == "--baseline-sizes")
+            {
+                std::vector<std::string> sizes = split(value);
+                config.baselineSizes.clear();
+                
+                for (auto itr = sizes.begin(); itr != sizes.end(); itr++)
+                {
+                    size_t size;
+                    if (!parseNumber(itr->c_str(), size) || size == 0) return false;
+                    
+                    config.baselineSizes.push_back(size);
+                }
+            }
+            else if (arg == "--json")
+            {
+                jsonPath = value;
+            }
+            else if (arg == "--record-trace")
+            {
+                trace.recordPath = value;
+            }
+            else if (arg == "--chrome-trace")
+            {
+                trace.chromeTracePath = value;
+            }
+            else if (arg == "--replay-trace")
+            {
+                trace.replayPath = value;
+            }
+            else if (arg == "--replay-speed")
+            {
+                std::string speed = value;
+                
+                if (speed != "max" && speed != "recorded") return false;
+                trace.recordedSpeed = speed == "recorded";
+            }
+            else if (arg == "--replay-traits")
+            {
+                std::string traits = value;
+                
+                if (traits != "default" && traits != "direct" && traits != "journaled" && traits != "staged" && traits != "shared") return false;
+                trace.traits = traits;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        
+        config.workload.readPercent = (unsigned int)readPercent;
+        config.workload.insertPercent = (unsigned int)insertPercent;
+        
+        return true;
+    }
+    
+    template<bool Assert>
+    static bool runValueSize(const DDBenchmarkConfig& config, bool printText, std::vector<DDBenchmarkResult>& results)
+    {
+        switch (config.valueSize)
+        {
+            case 8: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<8>, Assert>(config, printText); break;
+            case 16: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<16>, Assert>(config, printText); break;
+            case 32: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<32>, Assert>(config, printText); break;
+            case 64: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<64>, Assert>(config, printText); break;
+            case 128: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<128>, Assert>(config, printText); break;
+            case 256: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<256>, Assert>(config, printText); break;
+            case 512: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<512>, Assert>(config, printText); break;
+            case 1024: results = DDBenchmarkRunner::runBenchmarks<IdxType, DDBenchmarkValue<1024>, Assert>(config, printText); break;
+            default: return false;
+        }
+        
+        return true;
+    }
+    
+    //false after an error. records before it replays, so both options together replay the new trace.
+    static bool runTrace(DDBenchmarkConfig& config, const TraceOptions& trace, bool printText, std::vector<DDBenchmarkResult>& results)
+    {
+        if (!trace.recordPath.empty())
+        {
+            bool recorded;
+            
+            switch (config.valueSize)
+            {
+                case 8: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<8>>(config, trace.recordPath, trace.operations); break;
+                case 16: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<16>>(config, trace.recordPath, trace.operations); break;
+                case 32: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<32>>(config, trace.recordPath, trace.operations); break;
+                case 64: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<64>>(config, trace.recordPath, trace.operations); break;
+                case 128: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<128>>(config, trace.recordPath, trace.operations); break;
+                case 256: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<256>>(config, trace.recordPath, trace.operations); break;
+                case 512: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<512>>(config, trace.recordPath, trace.operations); break;
+                case 1024: recorded = DDBenchmarkRunner::recordTrace<IdxType, DDBenchmarkValue<1024>>(config, trace.recordPath, trace.operations); break;
+                default:
+                    std::cout << "DDBenchmarkDriver: unsupported value size " << config.valueSize << std::endl;
+                    return false;
+            }
+            
+            if (!recorded) return false;
+            
+            if (printText) std::cout << "recorded " << trace.recordPath << std::endl;
+        }
+        
+        if (trace.replayPath.empty()) return true;
+        
+        //the value size of the trace decides the index type.
+        DDOpTrace::Reader reader(trace.replayPath);
+        if (!reader.valid()) return false;
+        
+        config.valueSize = reader.header().valueSize;
+        
+        switch (config.valueSize)
+        {
+            case 8: return replayValueSize<8>(trace, config.latencySampleRate, printText, results);
+            case 16: return replayValueSize<16>(trace, config.latencySampleRate, printText, results);
+            case 32: return replayValueSize<32>(trace, config.latencySampleRate, printText, results);
+            case 64: return replayValueSize<64>(trace, config.latencySampleRate, printText, results);
+            case 128: return replayValueSize<128>(trace, config.latencySampleRate, printText, results);
+            case 256: return replayValueSize<256>(trace, config.latencySampleRate, printText, results);
+            case 512: return replayValueSize<512>(trace, config.latencySampleRate, printText, results);
+            case 1024: return replayValueSize<1024>(trace, config.latencySampleRate, printText, results);
+            default:
+                std::cout << "DDBenchmarkDriver: unsupported value size " << config.valueSize << std::endl;
+                return false;
+        }
+    }
+    
+    //replays with the traits of --replay-traits.
+    template<size_t Size>
+    static bool replayValueSize(const TraceOptions& trace, size_t latencySampleRate, bool printText, std::vector<DDBenchmarkResult>& results)
+    {
+        typedef DDBenchmarkValue<Size> Value;
+        
+        if (trace.traits == "direct")
+        {
+            if (!replayDirect<Size>(trace, latencySampleRate, printText, results, std::integral_constant<bool, Size <= 16>())) return false;
+        }
+        else if (trace.traits == "journaled")
+        {
+            results = DDBenchmarkRunner::replayTrace<IdxType, Value, DDJournaledMapTraits<Value>>(trace.replayPath, trace.recordedSpeed, latencySampleRate, printText, trace.traits);
+        }
+        else if (trace.traits == "staged")
+        {
+            results = DDBenchmarkRunner::replayTrace<IdxType, Value, DDStagedValueTraits<Value>>(trace.replayPath, trace.recordedSpeed, latencySampleRate, printText, trace.traits);
+        }
+        else if (trace.traits == "shared")
+        {
+            results = DDBenchmarkRunner::replayTrace<IdxType, Value, DDSharedReadTraits<Value>>(trace.replayPath, trace.recordedSpeed, latencySampleRate, printText, trace.traits);
+        }
+        else
+        {
+            results = DDBenchmarkRunner::replayTrace<IdxType, Value>(trace.replayPath, trace.recordedSpeed, latencySampleRate, printText);
+        }
+        
+        return !results.empty();
+    }
+    
+    template<size_t Size>
+    static bool replayDirect(const TraceOptions& trace, size_t latencySampleRate, bool printText, std::vector<DDBenchmarkResult>& results, std::true_type)
+    {
+        results = DDBenchmarkRunner::replayTrace<IdxType, DDBenchmarkValue<Size>, DDDirectValueTraits<DDBenchmarkValue<Size>>>(trace.replayPath, trace.recordedSpeed, latencySampleRate, printText, trace.traits);
+        
+        return true;
+    }
+    
+    //DDDirectValueTraits stores the values in the position maps.
+    template<size_t Size>
+    static bool replayDirect(const TraceOptions&, size_t, bool, std::vector<DDBenchmarkResult>&, std::false_type)
+    {
+        std::cout << "DDBenchmarkDriver: --replay-traits direct needs a trace of values up to 16 bytes" << std::endl;
+        return false;
+    }
+    
+    static void writeJson(std::ostream& out, const DDBenchmarkConfig& config, const std::vector<DDBenchmarkResult>& results)
+    {
+        out << "{\"config\": ";
+        config.writeJson(out);
+        out << ",\n\"results\": [";
+        
+        for (size_t i=0; i<results.size(); i++)
+        {
+            out << (i > 0 ? ",\n" : "\n");
+            results[i].writeJson(out);
+        }
+        
+        out << "\n]}" << std::endl;
+    }
+};
+
+#endif
@@ -24,12 +24,235 @@
 #include <functional>
 #include <chrono>
 #include <iomanip>
-#include <list>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <ostream>
 
 #include "DDIndex.h"
 #include "DDRandomGen.h"
+#include "DDHistogram.h"
+#include "DDWorkloadGen.h"
+#include "DDOpTrace.h"
+#include "DDImplicitTreap.h"
+#include "DDBaselines.h"
+#include "DDResourceUsage.h"
 
-template<typename IdxType, typename StoredType, size_t DDIndexSize>
+/*
+ Runtime parameters of the benchmarks. DDBenchmarkRunner::runBenchmarks<RunnerConfig>
+ builds them from a compile time RunnerConfig, the benchmark driver from the command line.
+*/
+class DDBenchmarkConfig
+{
+public:
+    DDBenchmarkConfig() :
+        indexSize(1000000),
+        valueSize(128),
+        randomReads(1000000),
+        randomReadWidth(1000000),
+        sequentialReads(1000000),
+        sequentialWrites(1000000),
+        randomWrites(1000000),
+        randomDeleteWrites(50000),
+        latencySampleRate(16),
+        concurrentOpsPerThread(100000),
+        concurrentMinThreads(1),
+        concurrentMaxThreads(64),
+        concurrentWriterPercent(25),
+        lockReadPercent(95),
+        mergeInsertPercent(50),
+        mergeWriteRate(100000),
+        mergeWriteSeconds(10),
+        baselineSizes({10000, 100000, 1000000}),
+        baselineOps(100000),
+        baselineSeconds(5),
+        seed(std::random_device()()),
+        rounds(0)
+    {}
+    
+    template<class RunnerConfig>
+    static DDBenchmarkConfig fromRunnerConfig()
+    {
+        DDBenchmarkConfig config;
+        
+        config.indexSize = RunnerConfig::IndexSize;
+        config.valueSize = sizeof(typename RunnerConfig::IndexObj);
+        config.randomReads = RunnerConfig::RandomReads;
+        config.randomReadWidth = RunnerConfig::RandomReadWidth;
+        config.sequentialReads = RunnerConfig::SequentialReads;
+        config.sequentialWrites = RunnerConfig::SequentialWrites;
+        config.randomWrites = RunnerConfig::RandomWrites;
+        config.randomDeleteWrites = RunnerConfig::RandomDeleteWrites;
+        config.latencySampleRate = RunnerConfig::LatencySampleRate;
+        config.concurrentOpsPerThread = RunnerConfig::ConcurrentOpsPerThread;
+        config.concurrentMaxThreads = RunnerConfig::ConcurrentMaxThreads;
+        config.concurrentWriterPercent = RunnerConfig::ConcurrentWriterPercent;
+        config.mergeInsertPercent = RunnerConfig::MergeInsertPercent;
+        config.mergeWriteRate = RunnerConfig::MergeWriteRate;
+        config.mergeWriteSeconds = RunnerConfig::MergeWriteSeconds;
+        config.baselineOps = RunnerConfig::BaselineOps;
+        config.baselineSeconds = RunnerConfig::BaselineSeconds;
+        
+        config.baselineSizes.clear();
+        for (size_t size = 10000; size <= RunnerConfig::BaselineMaxSize; size *= 10) config.baselineSizes.push_back(size);
+        
+        config.rounds = 10;
+        
+        return config;
+    }
+    
+    //an empty selection runs every benchmark.
+    bool selected(const std::string& benchmarkName) const
+    {
+        if (benchmarks.empty()) return true;
+        
+        for (auto itr = benchmarks.begin(); itr != benchmarks.end(); itr++)
+        {
+            if (*itr == benchmarkName) return true;
+        }
+        
+        return false;
+    }
+    
+    void writeJson(std::ostream& out) const
+    {
+        out << "{\"index_size\": " << indexSize;
+        out << ", \"value_size\": " << valueSize;
+        out << ", \"random_reads\": " << randomReads;
+        out << ", \"random_read_width\": " << randomReadWidth;
+        out << ", \"sequential_reads\": " << sequentialReads;
+        out << ", \"sequential_writes\": " << sequentialWrites;
+        out << ", \"random_writes\": " << randomWrites;
+        out << ", \"random_delete_writes\": " << randomDeleteWrites;
+        out << ", \"latency_sample_rate\": " << latencySampleRate;
+        out << ", \"concurrent_ops_per_thread\": " << concurrentOpsPerThread;
+        out << ", \"concurrent_min_threads\": " << concurrentMinThreads;
+        out << ", \"concurrent_max_threads\": " << concurrentMaxThreads;
+        out << ", \"concurrent_writer_percent\": " << concurrentWriterPercent;
+        out << ", \"lock_read_percent\": " << lockReadPercent;
+        out << ", \"merge_insert_percent\": " << mergeInsertPercent;
+        out << ", \"merge_write_rate\": " << mergeWriteRate;
+        out << ", \"merge_write_seconds\": " << mergeWriteSeconds;
+        out << ", \"baseline_sizes\": [";
+        
+        for (size_t i=0; i<baselineSizes.size(); i++)
+        {
+            out << (i > 0 ? ", " : "") << baselineSizes[i];
+        }
+        
+        out << "], \"baseline_ops\": " << baselineOps;
+        out << ", \"baseline_seconds\": " << baselineSeconds;
+        out << ", \"distribution\": \"" << DDWorkloadGen::distributionName(workload.distribution) << "\"";
+        out << ", \"zipf_theta\": " << workload.zipfTheta;
+        out << ", \"hotspot_fraction\": " << workload.hotspotFraction;
+        out << ", \"hotspot_op_fraction\": " << workload.hotspotOpFraction;
+        out << ", \"hotspot_start\": " << workload.hotspotStart;
+        out << ", \"seed\": " << seed;
+        out << ", \"rounds\": " << rounds;
+        out << ", \"benchmarks\": [";
+        
+        for (size_t i=0; i<benchmarks.size(); i++)
+        {
+            out << (i > 0 ? ", " : "") << "\"" << benchmarks[i] << "\"";
+        }
+        
+        out << "]}";
+    }
+    
+    size_t indexSize;
+    size_t valueSize;
+    
+    size_t randomReads;
+    size_t randomReadWidth;
+    size_t sequentialReads;
+    size_t sequentialWrites;
+    size_t randomWrites;
+    size_t randomDeleteWrites;
+    
+    size_t latencySampleRate;
+    
+    size_t concurrentOpsPerThread;
+    size_t concurrentMinThreads;
+    size_t concurrentMaxThreads;
+    size_t concurrentWriterPercent;
+    
+    //share of the gets in the lock policy comparison, the rest are writes.
+    size_t lockReadPercent;
+    
+    size_t mergeInsertPercent;
+    size_t mergeWriteRate;
+    size_t mergeWriteSeconds;
+    
+    //each phase of the baseline comparison stops after baselineOps ops or baselineSeconds.
+    std::vector<size_t> baselineSizes;
+    size_t baselineOps;
+    size_t baselineSeconds;
+    
+    //positions of the random benchmarks, the op mix is set by the benchmarks.
+    DDWorkloadGen::Config workload;
+    
+    unsigned int seed;
+    
+    //number of benchmarks run round robin, 0 runs each selected benchmark once.
+    size_t rounds;
+    std::vector<std::string> benchmarks;
+};
+
+//one result line of a benchmark, kept for the json output.
+class DDBenchmarkResult
+{
+public:
+    DDBenchmarkResult(const std::string& name) : name(name) {}
+    
+    void add(const std::string& key, double value)
+    {
+        values.push_back(std::make_pair(key, value));
+    }
+    
+    void addLatency(const std::string& prefix, const DDHistogram& latency)
+    {
+        add(prefix + "p50_us", latency.percentile(50) / 1000.0);
+        add(prefix + "p90_us", latency.percentile(90) / 1000.0);
+        add(prefix + "p99_us", latency.percentile(99) / 1000.0);
+        add(prefix + "p999_us", latency.percentile(99.9) / 1000.0);
+        add(prefix + "max_us", latency.max() / 1000.0);
+        add(prefix + "samples", latency.count());
+    }
+    
+    void writeJson(std::ostream& out) const
+    {
+        out << std::setprecision(15);
+        out << "{\"name\": \"" << name << "\"";
+        
+        for (auto itr = values.begin(); itr != values.end(); itr++)
+        {
+            out << ", \"" << itr->first << "\": " << itr->second;
+        }
+        
+        if (!threads.empty())
+        {
+            out << ", \"threads\": [";
+            
+            for (size_t i=0; i<threads.size(); i++)
+            {
+                if (i > 0) out << ", ";
+                threads[i].writeJson(out);
+            }
+            
+            out << "]";
+        }
+        
+        out << "}";
+    }
+    
+    std::string name;
+    std::vector<std::pair<std::string, double>> values;
+    std::vector<DDBenchmarkResult> threads;
+};
+
+template<typename IdxType, typename StoredType>
 class DDBenchmarks
 {
 private:
@@ -49,6 +272,39 @@ private:
         clock::time_point _start;
     };
     
+    //times every sampleRate-th operation into a histogram of nanoseconds.
+    class LatencyRecorder
+    {
+        typedef std::chrono::steady_clock clock;
+        
+    public:
+        LatencyRecorder(size_t sampleRate) :
+            _sampleRate(sampleRate > 0 ? sampleRate : 1),
+            _opCount(0)
+        {}
+        
+        template<class Func>
+        void record(const Func& func)
+        {
+            if (_opCount++ % _sampleRate != 0)
+            {
+                func();
+                return;
+            }
+            
+            clock::time_point start = clock::now();
+            func();
+            _histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+        }
+        
+        const DDHistogram& histogram() const { return _histogram; }
+        
+    private:
+        size_t _sampleRate;
+        size_t _opCount;
+        DDHistogram _histogram;
+    };
+    
     class DDIndexWrapper
     {
     public:
@@ -74,6 +330,8 @@ private:
         
         IdxType size() { return _ddIndex.size(); }
         
+        DDIndex<IdxType, StoredType>& ddIndex() { return _ddIndex; }
+        
         void unpersist()
         {
             _ddIndex.unpersist();
@@ -96,47 +354,48 @@ private:
             return _ddIndex.get(idx);
         }
         
+        //the model and the index are changed together, so concurrent writers keep them equal.
         void insertIdx(IdxType idx, StoredType yValue)
         {
-            typename std::list<StoredType>::iterator itr = _list.begin();
-            advance(itr, idx);
-            _list.insert(itr, yValue);
+            std::unique_lock<std::mutex> lock(_modelMutex);
+            
+            _model.insert(idx, yValue);
             _ddIndex.insertIdx(idx, yValue);
         }
         
         void deleteIdx(IdxType idx)
         {
-            typename std::list<StoredType>::iterator itr = _list.begin();
-            advance(itr, idx);
-            _list.erase(itr);
+            std::unique_lock<std::mutex> lock(_modelMutex);
+            
+            _model.erase(idx);
             _ddIndex.deleteIdx(idx);
         }
         
         IdxType size() { return _ddIndex.size(); }
         
+        DDIndex<IdxType, StoredType>& ddIndex() { return _ddIndex; }
+        
         void unpersist()
         {
             _ddIndex.unpersist();
-            _list.clear();
+            _model.clear();
         }
         
+        //compares every element.
         void check()
         {
-            assert(_list.size() == _ddIndex.size());
-        
-            unsigned int temp = 0;
-            IdxType idx = 0;
-            for(auto iter = _list.begin(); iter != _list.end(); iter++)
+            assert(_model.size() == _ddIndex.size());
+            
+            _model.forEach([this](size_t idx, const StoredType& value)
             {
-                assert(*iter == _ddIndex.get(idx));
-                
-                temp++;
-                idx++;
-            }
+                assert(value == _ddIndex.get((IdxType)idx));
+            });
         }
         
     protected:
-        std::list<StoredType> _list;
+        //O(log N) per op, so the checks scale to large indexes.
+        DDImplicitTreap<StoredType> _model;
+        std::mutex _modelMutex;
         DDIndex<IdxType, StoredType> _ddIndex;
     };
     
@@ -145,7 +404,10 @@ private:
     {
     public:
         
-        DDIndexHandle() : IndexWrapper(createDDIndex()) {}
+        DDIndexHandle(IdxType indexSize) :
+            IndexWrapper(createDDIndex()),
+            _indexSize(indexSize)
+        {}
         
         DDIndexHandle(const DDIndexHandle&) = delete;
         const DDIndexHandle& operator=(const DDIndexHandle&) = delete;
@@ -162,20 +424,22 @@ private:
             return DDIndex<IdxType, StoredType>(2, 0, 1, 2);
         }
         
+        IdxType indexSize() { return _indexSize; }
+        
         void fillDDIndex()
         {
             
             
-            assert(IndexWrapper::size() <= DDIndexSize);
+            assert(IndexWrapper::size() <= _indexSize);
             
             IdxType currSize = IndexWrapper::size();
             
-            for (int i=0; i<DDIndexSize - currSize; i++)
+            for (IdxType i=0; i<_indexSize - currSize; i++)
             {
                 IndexWrapper::insertIdx(i, StoredType::rand());
             }
             
-            assert(IndexWrapper::size() == DDIndexSize);
+            assert(IndexWrapper::size() == _indexSize);
         }
         
         void clearDDIndex()
@@ -183,6 +447,9 @@ private:
             IndexWrapper::unpersist();
             IndexWrapper::_ddIndex = createDDIndex();
         }
+        
+    private:
+        IdxType _indexSize;
     };
     
 public:
@@ -196,62 +463,423 @@ public:
     {
     public:
         
-        void benchmarkRes(std::string benchmarkName, microsec duration, size_t operations)
+        //only every latencySampleRate-th operation is timed, to keep the clock reads off the ops/sec.
+        Stats(size_t latencySampleRate = 1, bool printText = true) :
+            _latencySampleRate(latencySampleRate),
+            _printText(printText),
+            _runStart(0)
+        {}
+        
+        size_t latencySampleRate() { return _latencySampleRate; }
+        
+        const std::vector<DDBenchmarkResult>& results() { return _results; }
+        
+        void benchmarkRes(std::string benchmarkName, microsec duration, size_t operations, const DDHistogram& latency)
         {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("operations", operations);
+            result.add("duration_us", duration.count());
+            result.add("ops_per_sec", opsPerSec(duration, operations));
+            result.addLatency("", latency);
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
             std::cout << std::endl;
             std::cout << "-------------" << std::endl;
             std::cout << "Benchmark " << benchmarkName << std::endl;
-            std::cout << "OPS/SEC: " << (long long)(1000000.0 / (float)duration.count() * (float)operations)  << std::endl;
+            std::cout << "OPS/SEC: " << opsPerSec(duration, operations) << std::endl;
+            
+            printLatency(latency);
+            
             std::cout << "-------------" << std::endl;
         }
+        
+        void replayRes(std::string benchmarkName, const DDOpTrace::ReplayResult& replay)
+        {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("operations", replay.operations);
+            result.add("skipped", replay.skipped);
+            result.add("duration_us", replay.duration.count());
+            result.add("ops_per_sec", opsPerSec(replay.duration, replay.operations));
+            result.addLatency("get_", replay.latency[DDOpTrace::Get]);
+            result.addLatency("insert_", replay.latency[DDOpTrace::Insert]);
+            result.addLatency("delete_", replay.latency[DDOpTrace::Delete]);
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Replay " << benchmarkName << std::endl;
+            std::cout << "OPS/SEC: " << opsPerSec(replay.duration, replay.operations) << std::endl;
+            if (replay.skipped > 0) std::cout << "skipped: " << replay.skipped << std::endl;
+            
+            std::cout << "get" << std::endl;
+            printLatency(replay.latency[DDOpTrace::Get]);
+            std::cout << "insert" << std::endl;
+            printLatency(replay.latency[DDOpTrace::Insert]);
+            std::cout << "delete" << std::endl;
+            printLatency(replay.latency[DDOpTrace::Delete]);
+            
+            std::cout << "-------------" << std::endl;
+        }
+        
+        //result of one thread of a concurrent benchmark.
+        class ThreadRes
+        {
+        public:
+            ThreadRes() : writer(false), operations(0) {}
+            
+            bool writer;
+            microsec duration;
+            size_t operations;
+            DDHistogram latency;
+        };
+        
+        void concurrentRes(std::string benchmarkName, const std::vector<ThreadRes>& results)
+        {
+            size_t numOfWriters = 0;
+            
+            long long readOps = 0;
+            long long writeOps = 0;
+            
+            DDHistogram readLatency;
+            DDHistogram writeLatency;
+            
+            DDBenchmarkResult result(benchmarkName);
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                if (itr->writer)
+                {
+                    numOfWriters++;
+                    writeOps += opsPerSec(itr->duration, itr->operations);
+                    writeLatency.merge(itr->latency);
+                }
+                else
+                {
+                    readOps += opsPerSec(itr->duration, itr->operations);
+                    readLatency.merge(itr->latency);
+                }
+                
+                DDBenchmarkResult threadResult(itr->writer ? "writer" : "reader");
+                threadResult.add("operations", itr->operations);
+                threadResult.add("ops_per_sec", opsPerSec(itr->duration, itr->operations));
+                threadResult.addLatency("", itr->latency);
+                result.threads.push_back(threadResult);
+            }
+            
+            result.add("readers", results.size() - numOfWriters);
+            result.add("writers", numOfWriters);
+            result.add("ops_per_sec", readOps + writeOps);
+            result.add("read_ops_per_sec", readOps);
+            result.add("write_ops_per_sec", writeOps);
+            result.addLatency("read_", readLatency);
+            result.addLatency("write_", writeLatency);
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Benchmark " << benchmarkName << " readers: " << results.size() - numOfWriters << " writers: " << numOfWriters << std::endl;
+            std::cout << "OPS/SEC: " << readOps + writeOps << " reads: " << readOps << " writes: " << writeOps << std::endl;
+            
+            if (readLatency.count() > 0)
+            {
+                std::cout << "READ ";
+                printLatency(readLatency);
+            }
+            
+            if (writeLatency.count() > 0)
+            {
+                std::cout << "WRITE ";
+                printLatency(writeLatency);
+            }
+            
+            for (size_t i=0; i<results.size(); i++)
+            {
+                std::cout << (results[i].writer ? "writer " : "reader ") << i << " OPS/SEC: " << opsPerSec(results[i].duration, results[i].operations) << " ";
+                printLatency(results[i].latency);
+            }
+            
+            std::cout << "-------------" << std::endl;
+        }
+        
+        void mergeRes(std::string benchmarkName, IdxType indexSize, size_t pendingOps, microsec duration, const DDIndexMetrics::Snapshot& merge)
+        {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("index_size", indexSize);
+            result.add("pending_ops", pendingOps);
+            result.add("duration_us", duration.count());
+            result.add("ops_per_sec", opsPerSec(duration, pendingOps));
+            result.add("bytes", merge.counter(DDIndexMetrics::MergeBytes));
+            result.add("rewrite_us", merge.counter(DDIndexMetrics::MergeRewriteMicros));
+            result.add("delete_collect_us", merge.counter(DDIndexMetrics::MergeDeleteCollectMicros));
+            result.add("gap_close_us", merge.counter(DDIndexMetrics::MergeGapCloseMicros));
+            result.add("switch_us", merge.counter(DDIndexMetrics::MergeSwitchMicros));
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Benchmark " << benchmarkName << " N: " << indexSize << " P: " << pendingOps << std::endl;
+            std::cout << "OPS/SEC: " << opsPerSec(duration, pendingOps) << " BYTES: " << merge.counter(DDIndexMetrics::MergeBytes) << std::endl;
+            std::cout << "PHASES(us) rewrite: " << merge.counter(DDIndexMetrics::MergeRewriteMicros);
+            std::cout << " deleteCollect: " << merge.counter(DDIndexMetrics::MergeDeleteCollectMicros);
+            std::cout << " gapClose: " << merge.counter(DDIndexMetrics::MergeGapCloseMicros);
+            std::cout << " switch: " << merge.counter(DDIndexMetrics::MergeSwitchMicros) << std::endl;
+            std::cout << "-------------" << std::endl;
+        }
+        
+        void steadyStateRes(std::string benchmarkName, IdxType indexSize, microsec duration, size_t operations, double meanPending, size_t maxPending, size_t merges)
+        {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("index_size", indexSize);
+            result.add("write_ops_per_sec", opsPerSec(duration, operations));
+            result.add("merges", merges);
+            result.add("pending_mean", meanPending);
+            result.add("pending_max", maxPending);
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Benchmark " << benchmarkName << " N: " << indexSize << std::endl;
+            std::cout << "WRITE OPS/SEC: " << opsPerSec(duration, operations) << " MERGES: " << merges << std::endl;
+            std::cout << "P_N mean: " << (long long)meanPending << " max: " << maxPending << std::endl;
+            std::cout << "-------------" << std::endl;
+        }
+        
+        //one locking policy of the lock policy comparison, duration is the wall time of all threads.
+        class LockPolicyRes
+        {
+        public:
+            LockPolicyRes() : reads(0), writes(0) {}
+            
+            std::string policy;
+            
+            size_t reads;
+            size_t writes;
+            microsec duration;
+            
+            DDHistogram readLatency;
+            DDHistogram writeLatency;
+        };
+        
+        void lockPolicyRes(std::string benchmarkName, size_t numOfThreads, const std::vector<LockPolicyRes>& results)
+        {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("threads", numOfThreads);
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                result.add(itr->policy + "_read_ops_per_sec", opsPerSec(itr->duration, itr->reads));
+                result.add(itr->policy + "_write_ops_per_sec", opsPerSec(itr->duration, itr->writes));
+                result.addLatency(itr->policy + "_read_", itr->readLatency);
+                result.addLatency(itr->policy + "_write_", itr->writeLatency);
+            }
+            
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Benchmark " << benchmarkName << " threads: " << numOfThreads << std::endl;
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                std::cout << itr->policy << " OPS/SEC reads: " << opsPerSec(itr->duration, itr->reads) << " writes: " << opsPerSec(itr->duration, itr->writes) << std::endl;
+                std::cout << "READ ";
+                printLatency(itr->readLatency);
+                std::cout << "WRITE ";
+                printLatency(itr->writeLatency);
+            }
+            
+            std::cout << "-------------" << std::endl;
+        }
+        
+        //one structure of the baseline comparison.
+        class BaselineRes
+        {
+        public:
+            BaselineRes() : reads(0), inserts(0), deletes(0), bytes(0) {}
+            
+            std::string structure;
+            
+            size_t reads;
+            size_t inserts;
+            size_t deletes;
+            
+            microsec readDuration;
+            microsec insertDuration;
+            microsec deleteDuration;
+            
+            size_t bytes;
+        };
+        
+        void baselineRes(std::string benchmarkName, size_t indexSize, const std::vector<BaselineRes>& results)
+        {
+            DDBenchmarkResult result(benchmarkName);
+            result.add("index_size", indexSize);
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                result.add(itr->structure + "_read_ops_per_sec", opsPerSec(itr->readDuration, itr->reads));
+                result.add(itr->structure + "_insert_ops_per_sec", opsPerSec(itr->insertDuration, itr->inserts));
+                result.add(itr->structure + "_delete_ops_per_sec", opsPerSec(itr->deleteDuration, itr->deletes));
+                result.add(itr->structure + "_bytes", itr->bytes);
+            }
+            
+            _results.push_back(result);
+            
+            if (!_printText) return;
+            
+            std::cout << std::endl;
+            std::cout << "-------------" << std::endl;
+            std::cout << "Benchmark " << benchmarkName << " N: " << indexSize << std::endl;
+            std::cout << std::left << std::setw(16) << "" << std::setw(14) << "READS/SEC" << std::setw(14) << "INSERTS/SEC" << std::setw(14) << "DELETES/SEC" << "BYTES" << std::endl;
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                std::cout << std::setw(16) << itr->structure;
+                std::cout << std::setw(14) << opsPerSec(itr->readDuration, itr->reads);
+                std::cout << std::setw(14) << opsPerSec(itr->insertDuration, itr->inserts);
+                std::cout << std::setw(14) << opsPerSec(itr->deleteDuration, itr->deletes);
+                std::cout << itr->bytes << std::endl;
+            }
+            
+            std::cout << std::right;
+            std::cout << "-------------" << std::endl;
+        }
+        
+        //starts the resource accounting of one benchmark run.
+        void beginRun()
+        {
+            _runStart = _results.size();
+            _runUsage = DDResourceUsage::sample();
+        }
+        
+        //adds the page faults, rss, io and data files of the run to every result of it.
+        void endRun()
+        {
+            DDResourceUsage::Sample usage = DDResourceUsage::sample().since(_runUsage);
+            
+            for (size_t i=_runStart; i<_results.size(); i++)
+            {
+                _results[i].add("minor_faults", usage.minorFaults);
+                _results[i].add("major_faults", usage.majorFaults);
+                _results[i].add("max_rss_bytes", usage.maxRssBytes);
+                _results[i].add("io_read_bytes", usage.readBytes);
+                _results[i].add("io_write_bytes", usage.writeBytes);
+                _results[i].add("data_bytes_before", _runUsage.dataBytes);
+                _results[i].add("data_bytes_after", usage.dataBytes);
+            }
+            
+            if (!_printText) return;
+            
+            std::cout << "FAULTS minor: " << usage.minorFaults << " major: " << usage.majorFaults << " MAX RSS(MB): " << megabytes(usage.maxRssBytes) << std::endl;
+            std::cout << "IO(MB) read: " << megabytes(usage.readBytes) << " write: " << megabytes(usage.writeBytes);
+            std::cout << " DATA(MB) before: " << megabytes(_runUsage.dataBytes) << " after: " << megabytes(usage.dataBytes) << std::endl;
+            std::cout << "-------------" << std::endl;
+        }
+        
+    private:
+        size_t _latencySampleRate;
+        bool _printText;
+        std::vector<DDBenchmarkResult> _results;
+        
+        size_t _runStart;
+        DDResourceUsage::Sample _runUsage;
+        
+        static double megabytes(long long bytes)
+        {
+            return (double)bytes / (1024.0 * 1024.0);
+        }
+        
+        static long long opsPerSec(microsec duration, size_t operations)
+        {
+            return (long long)(1000000.0 / (float)duration.count() * (float)operations);
+        }
+        
+        static double micros(DDHistogram::ValueType nanos)
+        {
+            return (double)nanos / 1000.0;
+        }
+        
+        static void printLatency(const DDHistogram& latency)
+        {
+            std::cout << std::fixed << std::setprecision(2);
+            std::cout << "LATENCY(us) p50: " << micros(latency.percentile(50));
+            std::cout << " p90: " << micros(latency.percentile(90));
+            std::cout << " p99: " << micros(latency.percentile(99));
+            std::cout << " p99.9: " << micros(latency.percentile(99.9));
+            std::cout << " max: " << micros(latency.max());
+            std::cout << " samples: " << latency.count() << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+        }
     };
     
-    template<size_t NumOfWriteDeletes, class IndexHandle>
+    template<class IndexHandle>
     class RandomWriteDeleteBenchmark
     {
     public:
         
-        void run(IndexHandle& indexHandle, Stats& stats)
+        static std::string name() { return "RandomWriteDeleteBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
         {
+            size_t numOfWriteDeletes = config.randomDeleteWrites;
+            
             indexHandle.fillDDIndex();
             
             std::this_thread::sleep_for(std::chrono::seconds(1));
             
             Duration duration;
             
-            IdxType randDelIdx;
-            IdxType randInsertIdx;
+            IdxType randDelIdx = 0;
+            IdxType randInsertIdx = 0;
             IdxType indexSize;
             
-            auto randGen = DDRandomGen<IdxType>(0, indexHandle.size());
+            DDWorkloadGen workload(config.workload, config.seed);
             
-            for (int i=0; i<NumOfWriteDeletes*2; i++)
+            LatencyRecorder recorder(stats.latencySampleRate());
+            
+            for (size_t i=0; i<numOfWriteDeletes*2; i++)
             {
                 indexSize = indexHandle.size();
-                randDelIdx = randGen.randVal() % indexSize;
+                randDelIdx = workload.position(indexSize);
                 
-                indexHandle.deleteIdx(randDelIdx);
+                recorder.record([&]() { indexHandle.deleteIdx(randDelIdx); });
             }
             
-            for (int i=0; i<NumOfWriteDeletes; i++)
+            for (size_t i=0; i<numOfWriteDeletes; i++)
             {
                 indexSize = indexHandle.size();
-                randInsertIdx = randGen.randVal() % indexSize;
+                randInsertIdx = workload.position(indexSize);
                 
-                indexHandle.insertIdx(randDelIdx, StoredType::rand());
+                recorder.record([&]() { indexHandle.insertIdx(randInsertIdx, StoredType::rand()); });
             }
             
-            stats.benchmarkRes("RandomWriteDeleteBenchmark", duration.elapsed(), 2*NumOfWriteDeletes);
+            stats.benchmarkRes(name(), duration.elapsed(), 2*numOfWriteDeletes, recorder.histogram());
         }
     };
     
-    template<size_t NumOfWrites, class IndexHandle>
+    template<class IndexHandle>
     class RandomWriteBenchmark
     {
     public:
         
-        void run(IndexHandle& indexHandle, Stats& stats)
+        static std::string name() { return "RandomWriteBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
         {
+            size_t numOfWrites = config.randomWrites;
+            
             indexHandle.clearDDIndex();
             
             Duration duration;
@@ -259,121 +887,609 @@ public:
             IdxType randInsertIdx;
             IdxType indexSize;
             
-            auto randGen = DDRandomGen<IdxType>(0, NumOfWrites);
+            DDWorkloadGen workload(config.workload, config.seed);
             
-            for (int i=0; i<NumOfWrites; i++)
+            LatencyRecorder recorder(stats.latencySampleRate());
+            
+            for (size_t i=0; i<numOfWrites; i++)
             {
                 indexSize = indexHandle.size();
                 //TODO check this!
-                if (indexSize > 0) randInsertIdx = randGen.randVal() % indexSize;
+                if (indexSize > 0) randInsertIdx = workload.position(indexSize);
                 else randInsertIdx = 0;
 
-                indexHandle.insertIdx(randInsertIdx, StoredType::rand());
+                recorder.record([&]() { indexHandle.insertIdx(randInsertIdx, StoredType::rand()); });
             }
             
-            stats.benchmarkRes("RandomWriteBenchmark", duration.elapsed(), NumOfWrites);
+            stats.benchmarkRes(name(), duration.elapsed(), numOfWrites, recorder.histogram());
         }
     };
     
-    template<size_t NumOfWrites, class IndexHandle>
+    template<class IndexHandle>
     class SequentialWriteBenchmark
     {
     public:
         
-        void run(IndexHandle& indexHandle, Stats& stats)
+        static std::string name() { return "SequentialWriteBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
         {
+            size_t numOfWrites = config.sequentialWrites;
+            
             indexHandle.clearDDIndex();
             
             Duration duration;
             
-            for (int i=0; i<NumOfWrites; i++)
+            LatencyRecorder recorder(stats.latencySampleRate());
+            
+            for (size_t i=0; i<numOfWrites; i++)
             {
-                indexHandle.insertIdx(i, StoredType::rand());
+                recorder.record([&]() { indexHandle.insertIdx(i, StoredType::rand()); });
             }
             
-            stats.benchmarkRes("SequentialWriteBenchmark", duration.elapsed(), NumOfWrites);
+            stats.benchmarkRes(name(), duration.elapsed(), numOfWrites, recorder.histogram());
         }
     };
     
-    template<size_t NumOfReads, class IndexHandle>
+    template<class IndexHandle>
     class SequentialReadBenchmark
     {
     public:
         
-        void run(IndexHandle& indexHandle, Stats& stats)
+        static std::string name() { return "SequentialReadBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
         {
+            size_t numOfReads = config.sequentialReads;
+            IdxType indexSize = indexHandle.indexSize();
+            
             indexHandle.fillDDIndex();
             
             std::this_thread::sleep_for(std::chrono::seconds(1));
             
-            IdxType idx = DDRandomGen<IdxType>(0, DDIndexSize).randVal();
+            IdxType idx = DDRandomGen<IdxType>(0, indexSize).randVal();
             
             Duration duration;
             
-            for (IdxType i = 0; i<NumOfReads; i++)
+            LatencyRecorder recorder(stats.latencySampleRate());
+            
+            for (IdxType i = 0; i<numOfReads; i++)
             {
-                if (idx == 0) idx = DDIndexSize - 1;
+                if (idx == 0) idx = indexSize - 1;
                 idx--;
                 
-                indexHandle.get(idx);
+                recorder.record([&]() { indexHandle.get(idx); });
             }
             
-            stats.benchmarkRes("SequentialReadBenchmark", duration.elapsed(), NumOfReads);
+            stats.benchmarkRes(name(), duration.elapsed(), numOfReads, recorder.histogram());
         }
     };
     
-    template<size_t NumOfReads, size_t ReadWidth, class IndexHandle>
+    template<class IndexHandle>
     class RandomReadBenchmark
     {
-        static_assert(ReadWidth <= DDIndexSize, "RandomReadBenchmark error ReadWidth > DDIndexSize");
-        
     public:
         
-        void run(IndexHandle& indexHandle, Stats& stats)
+        static std::string name() { return "RandomReadBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
         {
+            size_t numOfReads = config.randomReads;
+            IdxType readWidth = config.randomReadWidth;
+            IdxType indexSize = indexHandle.indexSize();
+            
+            assert(readWidth <= indexSize);
+            
             indexHandle.fillDDIndex();
             
             std::this_thread::sleep_for(std::chrono::seconds(3));
             
-            IdxType startIdx = DDRandomGen<IdxType>(0, DDIndexSize).randVal();
+            IdxType startIdx = DDRandomGen<IdxType>(0, indexSize).randVal();
             
-            auto randGen = DDRandomGen<IdxType>(0, ReadWidth);
+            DDWorkloadGen workload(config.workload, config.seed);
             
             IdxType rndNumb;
             IdxType idx;
             
             Duration duration;
             
-            for (IdxType i = 0; i<NumOfReads; i++)
+            LatencyRecorder recorder(stats.latencySampleRate());
+            
+            for (IdxType i = 0; i<numOfReads; i++)
             {
-                rndNumb = randGen.randVal();
+                rndNumb = workload.position(readWidth);
                 
-                if (rndNumb > startIdx) idx = DDIndexSize - (rndNumb - startIdx) - 1;
+                if (rndNumb > startIdx) idx = indexSize - (rndNumb - startIdx) - 1;
                 else idx = startIdx - rndNumb;
                 
-                indexHandle.get(idx);
+                recorder.record([&]() { indexHandle.get(idx); });
+            }
+            
+            stats.benchmarkRes(name(), duration.elapsed(), numOfReads, recorder.histogram());
+        }
+    };
+    
+    /*
+     * Readers and writers on one index while the merges run, for concurrentMinThreads, doubled up to
+     * concurrentMaxThreads threads. concurrentWriterPercent of the threads are writers, every thread
+     * runs concurrentOpsPerThread operations.
+     */
+    template<class IndexHandle>
+    class ConcurrentReadWriteBenchmark
+    {
+    public:
+        
+        static std::string name() { return "ConcurrentReadWriteBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
+        {
+            indexHandle.fillDDIndex();
+            
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            
+            for (size_t numOfThreads = std::max<size_t>(config.concurrentMinThreads, 1); numOfThreads <= config.concurrentMaxThreads; numOfThreads *= 2)
+            {
+                size_t numOfWriters = (numOfThreads * config.concurrentWriterPercent + 50) / 100;
+                
+                run(indexHandle, stats, config, numOfThreads - numOfWriters, numOfWriters);
+            }
+        }
+        
+    private:
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config, size_t numOfReaders, size_t numOfWriters)
+        {
+            size_t opsPerThread = config.concurrentOpsPerThread;
+            
+            //the writers insert and delete alternately, so the index never gets smaller than baseSize.
+            IdxType baseSize = indexHandle.size();
+            
+            std::vector<typename Stats::ThreadRes> results(numOfReaders + numOfWriters);
+            
+            //StoredType::rand is not thread safe.
+            std::vector<std::vector<StoredType>> values(numOfWriters);
+            
+            for (size_t i=0; i<numOfWriters; i++)
+            {
+                for (size_t j=0; j<opsPerThread/2 + 1; j++) values[i].push_back(StoredType::rand());
+            }
+            
+            std::atomic<bool> start(false);
+            std::vector<std::thread> threads;
+            
+            for (size_t t=0; t<results.size(); t++)
+            {
+                DDWorkloadGen workload(config.workload, DDFastRandom::seedFor(config.seed, t));
+                
+                threads.push_back(std::thread([&indexHandle, &stats, &results, &values, &start, baseSize, numOfReaders, opsPerThread, workload, t]() mutable
+                {
+                    bool writer = t >= numOfReaders;
+                    
+                    LatencyRecorder recorder(stats.latencySampleRate());
+                    
+                    while (!start) std::this_thread::yield();
+                    
+                    Duration duration;
+                    
+                    for (size_t i=0; i<opsPerThread; i++)
+                    {
+                        IdxType idx = workload.position(baseSize);
+                        
+                        if (!writer) recorder.record([&]() { indexHandle.get(idx); });
+                        else if (i % 2 == 0) recorder.record([&]() { indexHandle.insertIdx(idx, values[t - numOfReaders][i/2]); });
+                        else recorder.record([&]() { indexHandle.deleteIdx(idx); });
+                    }
+                    
+                    results[t].duration = duration.elapsed();
+                    results[t].writer = writer;
+                    results[t].operations = opsPerThread;
+                    results[t].latency = recorder.histogram();
+                }));
+            }
+            
+            start = true;
+            
+            for (auto itr = threads.begin(); itr != threads.end(); itr++) itr->join();
+            
+            //an odd number of operations leaves one insert per writer.
+            while (indexHandle.size() > baseSize) indexHandle.deleteIdx(indexHandle.size() - 1);
+            
+            stats.concurrentRes(name(), results);
+        }
+    };
+    
+    /*
+     * The exclusive index lock against DDSharedReadTraits. Both policies get their own index of
+     * indexSize elements. For concurrentMinThreads up to concurrentMaxThreads threads every thread
+     * runs concurrentOpsPerThread operations, lockReadPercent of them gets, the writes insert and
+     * delete alternately.
+     */
+    template<class IndexHandle>
+    class LockPolicyBenchmark
+    {
+    public:
+        
+        static std::string name() { return "LockPolicyBenchmark"; }
+        
+        void run(IndexHandle&, Stats& stats, const DDBenchmarkConfig& config)
+        {
+            DDIndex<IdxType, StoredType> exclusiveIndex(4, 0, 1, 2);
+            DDIndex<IdxType, StoredType, DDSharedReadTraits<StoredType>> sharedIndex(5, 0, 1, 2);
+            
+            fill(exclusiveIndex, config.indexSize);
+            fill(sharedIndex, config.indexSize);
+            
+            for (size_t numOfThreads = std::max<size_t>(config.concurrentMinThreads, 1); numOfThreads <= config.concurrentMaxThreads; numOfThreads *= 2)
+            {
+                std::vector<typename Stats::LockPolicyRes> results;
+                
+                results.push_back(measure("exclusive", exclusiveIndex, stats, config, numOfThreads));
+                results.push_back(measure("shared", sharedIndex, stats, config, numOfThreads));
+                
+                stats.lockPolicyRes(name(), numOfThreads, results);
+            }
+            
+            exclusiveIndex.unpersist();
+            sharedIndex.unpersist();
+        }
+        
+    private:
+        
+        template<class Index>
+        static void fill(Index& index, size_t indexSize)
+        {
+            for (size_t i=0; i<indexSize; i++) index.insertIdx((IdxType)i, StoredType::rand());
+            
+            index.flush();
+        }
+        
+        template<class Index>
+        static typename Stats::LockPolicyRes measure(const std::string& policy, Index& index, Stats& stats, const DDBenchmarkConfig& config, size_t numOfThreads)
+        {
+            size_t opsPerThread = config.concurrentOpsPerThread;
+            
+            //the writes of a thread insert and delete alternately, so the index never gets smaller than baseSize.
+            IdxType baseSize = index.size();
+            
+            DDWorkloadGen::Config workloadConfig = config.workload;
+            workloadConfig.readPercent = (unsigned int)config.lockReadPercent;
+            workloadConfig.insertPercent = 0;
+            
+            //StoredType::rand is not thread safe.
+            std::vector<StoredType> values;
+            for (size_t i=0; i<opsPerThread; i++) values.push_back(StoredType::rand());
+            
+            std::vector<typename Stats::LockPolicyRes> results(numOfThreads);
+            
+            std::atomic<bool> start(false);
+            std::vector<std::thread> threads;
+            
+            for (size_t t=0; t<numOfThreads; t++)
+            {
+                DDWorkloadGen workload(workloadConfig, DDFastRandom::seedFor(config.seed, t));
+                
+                threads.push_back(std::thread([&index, &stats, &results, &values, &start, baseSize, opsPerThread, workload, t]() mutable
+                {
+                    LatencyRecorder readRecorder(stats.latencySampleRate());
+                    LatencyRecorder writeRecorder(stats.latencySampleRate());
+                    
+                    typename Stats::LockPolicyRes& res = results[t];
+                    
+                    while (!start) std::this_thread::yield();
+                    
+                    for (size_t i=0; i<opsPerThread; i++)
+                    {
+                        IdxType idx = workload.position(baseSize);
+                        
+                        if (workload.op() == DDWorkloadGen::Read)
+                        {
+                            readRecorder.record([&]() { index.get(idx); });
+                            res.reads++;
+                        }
+                        else if (res.writes++ % 2 == 0)
+                        {
+                            writeRecorder.record([&]() { index.insertIdx(idx, values[i]); });
+                        }
+                        else
+                        {
+                            writeRecorder.record([&]() { index.deleteIdx(idx); });
+                        }
+                    }
+                    
+                    res.readLatency = readRecorder.histogram();
+                    res.writeLatency = writeRecorder.histogram();
+                }));
+            }
+            
+            Duration duration;
+            start = true;
+            
+            for (auto itr = threads.begin(); itr != threads.end(); itr++) itr->join();
+            
+            typename Stats::LockPolicyRes res;
+            res.policy = policy;
+            res.duration = duration.elapsed();
+            
+            for (auto itr = results.begin(); itr != results.end(); itr++)
+            {
+                res.reads += itr->reads;
+                res.writes += itr->writes;
+                res.readLatency.merge(itr->readLatency);
+                res.writeLatency.merge(itr->writeLatency);
+            }
+            
+            //an odd number of writes leaves one insert per thread.
+            while (index.size() > baseSize) index.deleteIdx(index.size() - 1);
+            
+            return res;
+        }
+    };
+    
+    /*
+     * Drain rate of the merges. For N = indexSize/100, /10 and indexSize it loads N elements,
+     * adds P = N/100, N/10 and N/2 pending operations (mergeInsertPercent of them inserts, at the
+     * positions of the workload distribution) with the background merges paused and times one merge per phase.
+     * Afterwards it writes mergeWriteRate ops/sec for mergeWriteSeconds with the background merges
+     * running and samples the resulting pending operations P_N.
+     */
+    template<class IndexHandle>
+    class MergeThroughputBenchmark
+    {
+    public:
+        
+        static std::string name() { return "MergeThroughputBenchmark"; }
+        
+        void run(IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
+        {
+            DDWorkloadGen::Config workloadConfig = config.workload;
+            workloadConfig.readPercent = 0;
+            workloadConfig.insertPercent = config.mergeInsertPercent;
+            
+            _workload = DDUtils::make_unique<DDWorkloadGen>(workloadConfig, config.seed);
+            
+            for (IdxType indexSize = indexHandle.indexSize() / 100; indexSize <= indexHandle.indexSize(); indexSize *= 10)
+            {
+                load(indexHandle, indexSize);
+                
+                indexHandle.ddIndex().setAutoMerge(false);
+                
+                for (size_t pendingOps : {indexSize / 100, indexSize / 10, indexSize / 2})
+                {
+                    if (pendingOps == 0) continue;
+                    
+                    runMerge(indexHandle, stats, pendingOps);
+                }
+                
+                indexHandle.ddIndex().setAutoMerge(true);
+                
+                if (indexSize == 0) break;
+            }
+            
+            runSteadyState(indexHandle, stats, config.mergeWriteRate, config.mergeWriteSeconds);
+            
+            //the random inserts and deletes leave the index at an arbitrary size.
+            indexHandle.clearDDIndex();
+        }
+        
+    private:
+        std::unique_ptr<DDWorkloadGen> _workload;
+        
+        void load(IndexHandle& indexHandle, IdxType indexSize)
+        {
+            indexHandle.clearDDIndex();
+            
+            for (IdxType i=0; i<indexSize; i++)
+            {
+                indexHandle.insertIdx(i, StoredType::rand());
+            }
+            
+            indexHandle.ddIndex().flush();
+        }
+        
+        void writeOp(IndexHandle& indexHandle)
+        {
+            IdxType indexSize = indexHandle.size();
+            
+            if (indexSize == 0 || _workload->op() == DDWorkloadGen::Insert)
+            {
+                indexHandle.insertIdx(_workload->position(indexSize + 1), StoredType::rand());
+            }
+            else
+            {
+                indexHandle.deleteIdx(_workload->position(indexSize));
+            }
+        }
+        
+        void runMerge(IndexHandle& indexHandle, Stats& stats, size_t pendingOps)
+        {
+            IdxType indexSize = indexHandle.size();
+            
+            for (size_t i=0; i<pendingOps; i++) writeOp(indexHandle);
+            
+            DDIndexMetrics::Snapshot before = indexHandle.ddIndex().metrics();
+            
+            Duration duration;
+            indexHandle.ddIndex().flush();
+            microsec elapsed = duration.elapsed();
+            
+            stats.mergeRes(name(), indexSize, pendingOps, elapsed, indexHandle.ddIndex().metrics().since(before));
+        }
+        
+        void runSteadyState(IndexHandle& indexHandle, Stats& stats, size_t writeRate, size_t writeSeconds)
+        {
+            static const std::chrono::milliseconds sampleInterval(10);
+            
+            DDIndexMetrics::Snapshot before = indexHandle.ddIndex().metrics();
+            IdxType indexSize = indexHandle.size();
+            
+            size_t operations = 0;
+            size_t samples = 0;
+            size_t sumPending = 0;
+            size_t maxPending = 0;
+            
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point end = start + std::chrono::seconds(writeSeconds);
+            std::chrono::steady_clock::time_point nextSample = start;
+            
+            Duration duration;
+            
+            for (std::chrono::steady_clock::time_point now = start; now < end; now = std::chrono::steady_clock::now())
+            {
+                //the writes are paced to writeRate.
+                size_t dueOps = std::chrono::duration_cast<microsec>(now - start).count() * writeRate / 1000000;
+                
+                if (operations < dueOps)
+                {
+                    writeOp(indexHandle);
+                    operations++;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+                
+                if (now >= nextSample)
+                {
+                    DDIndexMetrics::Snapshot snapshot = indexHandle.ddIndex().metrics();
+                    
+                    size_t pending = snapshot.gauge(DDIndexMetrics::PendingOps) + snapshot.gauge(DDIndexMetrics::MergingOps);
+                    
+                    sumPending += pending;
+                    maxPending = std::max(maxPending, pending);
+                    samples++;
+                    
+                    nextSample += sampleInterval;
+                }
+            }
+            
+            microsec elapsed = duration.elapsed();
+            
+            size_t merges = indexHandle.ddIndex().metrics().since(before).counter(DDIndexMetrics::Merges);
+            
+            stats.steadyStateRes(name() + " steady state", indexSize, elapsed, operations, samples > 0 ? (double)sumPending / samples : 0, maxPending, merges);
+        }
+    };
+    
+    /*
+     * The same random reads, inserts and deletes against std::vector, a pb_ds order statistic tree,
+     * DDCountedBTree and a DDIndex of its own, for every size in baselineSizes. The inserts and
+     * deletes include the flush of the DDIndex, so its merges are paid for.
+     */
+    template<class IndexHandle>
+    class BaselineComparisonBenchmark
+    {
+    public:
+        
+        static std::string name() { return "BaselineComparisonBenchmark"; }
+        
+        void run(IndexHandle&, Stats& stats, const DDBenchmarkConfig& config)
+        {
+            for (auto itr = config.baselineSizes.begin(); itr != config.baselineSizes.end(); itr++)
+            {
+                std::vector<typename Stats::BaselineRes> results;
+                
+                results.push_back(measure<DDVectorBaseline<IdxType, StoredType>>(*itr, config));
+#ifdef __GLIBCXX__
+                results.push_back(measure<DDOrderStatTreeBaseline<IdxType, StoredType>>(*itr, config));
+#endif
+                results.push_back(measure<DDCountedBTreeBaseline<IdxType, StoredType>>(*itr, config));
+                results.push_back(measure<DDIndexBaseline<IdxType, StoredType>>(*itr, config));
+                
+                stats.baselineRes(name(), *itr, results);
             }
+        }
+        
+    private:
+        static const size_t NumOfValues = 1024;
+        static const size_t CheckInterval = 64;
+        
+        template<class Baseline>
+        static typename Stats::BaselineRes measure(size_t indexSize, const DDBenchmarkConfig& config)
+        {
+            typename Stats::BaselineRes res;
+            res.structure = Baseline::name();
+            
+            std::vector<StoredType> values;
+            for (size_t i=0; i<NumOfValues; i++) values.push_back(StoredType::rand());
+            
+            Baseline baseline;
+            
+            for (size_t i=0; i<indexSize; i++) baseline.append(values[i % NumOfValues]);
+            
+            baseline.flush();
+            res.bytes = baseline.memoryBytes();
+            
+            DDWorkloadGen workload(config.workload, config.seed);
+            std::chrono::seconds limit(config.baselineSeconds);
+            
+            //keeps the reads from being optimized away.
+            volatile size_t matches = 0;
+            
+            Duration reads;
+            
+            for (; res.reads < config.baselineOps; res.reads++)
+            {
+                if (baseline.get((IdxType)workload.position(indexSize)) == values[0]) matches++;
+                
+                if (res.reads % CheckInterval == 0 && reads.elapsed() > limit) break;
+            }
+            
+            res.readDuration = reads.elapsed();
+            
+            Duration inserts;
+            
+            for (; res.inserts < config.baselineOps; res.inserts++)
+            {
+                baseline.insertIdx((IdxType)workload.position(indexSize + res.inserts + 1), values[res.inserts % NumOfValues]);
+                
+                if (res.inserts % CheckInterval == 0 && inserts.elapsed() > limit) break;
+            }
+            
+            baseline.flush();
+            res.insertDuration = inserts.elapsed();
+            
+            //back to indexSize.
+            Duration deletes;
+            
+            for (; res.deletes < res.inserts; res.deletes++)
+            {
+                baseline.deleteIdx((IdxType)workload.position(indexSize + res.inserts - res.deletes));
+            }
+            
+            baseline.flush();
+            res.deleteDuration = deletes.elapsed();
             
-            stats.benchmarkRes("RandomReadBenchmark", duration.elapsed(), NumOfReads);
+            return res;
         }
     };
     
     template<size_t Idx, class IndexHandle>
-    static void run(size_t index, IndexHandle& indexHandle, Stats& stats) {}
+    static void run(size_t, IndexHandle&, Stats&, const DDBenchmarkConfig&) {}
     
     template<size_t Idx, class IndexHandle, typename Benchmark, typename... Benchmarks>
-    static void run(size_t index, IndexHandle& indexHandle, Stats& stats)
+    static void run(size_t index, IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
     {
-        if (Idx == index) Benchmark().run(indexHandle, stats);
-        run<Idx+1, IndexHandle, Benchmarks...>(index, indexHandle, stats);
+        if (Idx == index) Benchmark().run(indexHandle, stats, config);
+        run<Idx+1, IndexHandle, Benchmarks...>(index, indexHandle, stats, config);
     }
     
     template<class IndexHandle, typename... Benchmarks>
-    static void run(size_t index, IndexHandle& indexHandle, Stats& stats)
+    static void run(size_t index, IndexHandle& indexHandle, Stats& stats, const DDBenchmarkConfig& config)
     {
         index = index % sizeof...(Benchmarks);
         
-        run<0, IndexHandle, Benchmarks...>(index, indexHandle, stats);
+        run<0, IndexHandle, Benchmarks...>(index, indexHandle, stats, config);
+    }
+    
+    template<size_t Idx>
+    static void selectedIdxs(const DDBenchmarkConfig&, std::vector<size_t>&) {}
+    
+    //positions of the benchmarks which are selected in the config.
+    template<size_t Idx, typename Benchmark, typename... Benchmarks>
+    static void selectedIdxs(const DDBenchmarkConfig& config, std::vector<size_t>& idxs)
+    {
+        if (config.selected(Benchmark::name())) idxs.push_back(Idx);
+        selectedIdxs<Idx+1, Benchmarks...>(config, idxs);
     }
     
     template<class Dummy, bool Assert>
@@ -395,7 +1511,7 @@ public:
     class CheckHandle
     {
     public:
-        static void check(IndexHandle& handle) {};
+        static void check(IndexHandle&) {};
     };
     
     template<class IndexHandle>
@@ -409,6 +1525,7 @@ public:
     };
 };
 
+
 /*
  RunnerConfig
  
@@ -425,6 +1542,20 @@ public:
  size_t RunnerConfig::RandomWrites
  size_t RunnerConfig::RandomDeleteWrites
  
+ size_t RunnerConfig::LatencySampleRate
+ 
+ size_t RunnerConfig::ConcurrentOpsPerThread
+ size_t RunnerConfig::ConcurrentMaxThreads
+ size_t RunnerConfig::ConcurrentWriterPercent
+ 
+ size_t RunnerConfig::MergeInsertPercent
+ size_t RunnerConfig::MergeWriteRate
+ size_t RunnerConfig::MergeWriteSeconds
+ 
+ size_t RunnerConfig::BaselineMaxSize
+ size_t RunnerConfig::BaselineOps
+ size_t RunnerConfig::BaselineSeconds
+ 
  IndexObj RunnerConfig::IndexObj
 */
 
@@ -433,6 +1564,34 @@ public:
  static IndexObj rand();
 */
 
+//IndexObj of Size bytes for the benchmark driver.
+template<size_t Size>
+class DDBenchmarkValue
+{
+    static_assert(Size > sizeof(unsigned int), "DDBenchmarkValue error Size <= sizeof(unsigned int)");
+    
+public:
+    
+    static DDBenchmarkValue rand()
+    {
+        static DDRandomGen<unsigned int> randGen = DDRandomGen<unsigned int>();
+        
+        DDBenchmarkValue value;
+        value._id = randGen.randVal();
+        
+        return value;
+    }
+    
+    bool operator== (const DDBenchmarkValue& other) const
+    {
+        return _id == other._id;
+    }
+    
+private:
+    unsigned int _id;
+    char _payload[Size - sizeof(unsigned int)];
+};
+
 class DDBenchmarkRunner
 {
 public:
@@ -441,31 +1600,62 @@ public:
     template<typename RunnerConfig>
     static void runBenchmarks()
     {
-        typedef DDBenchmarks<typename RunnerConfig::IdxType,typename RunnerConfig::IndexObj, RunnerConfig::IndexSize> BenchmarkType;
+        runBenchmarks<typename RunnerConfig::IdxType, typename RunnerConfig::IndexObj, RunnerConfig::Assert>(DDBenchmarkConfig::fromRunnerConfig<RunnerConfig>());
+    }
+    
+    template<typename IdxType, typename IndexObj, bool Assert>
+    static std::vector<DDBenchmarkResult> runBenchmarks(const DDBenchmarkConfig& config, bool printText = true)
+    {
+        typedef DDBenchmarks<IdxType, IndexObj> BenchmarkType;
         
         //BenchmarkType benchmarks;
         
-        typedef typename BenchmarkType::template IndexHandleTrait<Dummy, RunnerConfig::Assert>::type IndexHandleType;
+        typedef typename BenchmarkType::template IndexHandleTrait<Dummy, Assert>::type IndexHandleType;
     
         
-        IndexHandleType ddIndexHandle;
-        typename BenchmarkType::Stats stats;
+        IndexHandleType ddIndexHandle(config.indexSize);
+        typename BenchmarkType::Stats stats(config.latencySampleRate, printText);
         
         //
         //Benchmark types.
-        typedef typename BenchmarkType::template SequentialReadBenchmark<RunnerConfig::SequentialReads, IndexHandleType> SequentialReadBMType;
-        typedef typename BenchmarkType::template RandomReadBenchmark<RunnerConfig::RandomReads, RunnerConfig::RandomReadWidth, IndexHandleType> RandomReadBMType;
-        typedef typename BenchmarkType::template SequentialWriteBenchmark<RunnerConfig::SequentialWrites, IndexHandleType> SequentialWriteBMType;
-        typedef typename BenchmarkType::template RandomWriteBenchmark<RunnerConfig::RandomWrites, IndexHandleType> RandomWriteBMType;
-        typedef typename BenchmarkType::template RandomWriteDeleteBenchmark<RunnerConfig::RandomDeleteWrites, IndexHandleType> RandomWriteDeleteBMType;
+        typedef typename BenchmarkType::template SequentialReadBenchmark<IndexHandleType> SequentialReadBMType;
+        typedef typename BenchmarkType::template RandomReadBenchmark<IndexHandleType> RandomReadBMType;
+        typedef typename BenchmarkType::template SequentialWriteBenchmark<IndexHandleType> SequentialWriteBMType;
+        typedef typename BenchmarkType::template RandomWriteBenchmark<IndexHandleType> RandomWriteBMType;
+        typedef typename BenchmarkType::template RandomWriteDeleteBenchmark<IndexHandleType> RandomWriteDeleteBMType;
+        typedef typename BenchmarkType::template ConcurrentReadWriteBenchmark<IndexHandleType> ConcurrentReadWriteBMType;
+        typedef typename BenchmarkType::template LockPolicyBenchmark<IndexHandleType> LockPolicyBMType;
+        typedef typename BenchmarkType::template MergeThroughputBenchmark<IndexHandleType> MergeThroughputBMType;
+        typedef typename BenchmarkType::template BaselineComparisonBenchmark<IndexHandleType> BaselineComparisonBMType;
         //
         //
         
         //Type for checking the index if requested.
-        typedef typename BenchmarkType::template CheckHandle<IndexHandleType, RunnerConfig::Assert> CheckHandleType;
+        typedef typename BenchmarkType::template CheckHandle<IndexHandleType, Assert> CheckHandleType;
+        
+        std::vector<size_t> selected;
+        
+        BenchmarkType::template selectedIdxs
+        <
+        0,
+        
+        SequentialReadBMType,
+        RandomReadBMType,
+        SequentialWriteBMType,
+        RandomWriteBMType,
+        RandomWriteDeleteBMType,
+        ConcurrentReadWriteBMType,
+        LockPolicyBMType,
+        MergeThroughputBMType,
+        BaselineComparisonBMType
+        >(config, selected);
+        
+        size_t rounds = config.rounds > 0 ? config.rounds : selected.size();
         
-        for (int i=0; i<10; i++)
+        for (size_t i=0; i<rounds && !selected.empty(); i++)
         {
+            stats.beginRun();
+            
             BenchmarkType::template run
             <
             IndexHandleType,
@@ -474,13 +1664,89 @@ public:
             RandomReadBMType,
             SequentialWriteBMType,
             RandomWriteBMType,
-            RandomWriteDeleteBMType
+            RandomWriteDeleteBMType,
+            ConcurrentReadWriteBMType,
+            LockPolicyBMType,
+            MergeThroughputBMType,
+            BaselineComparisonBMType
             
             //... more benchmarks.
-            >(i, ddIndexHandle, stats);
+            >(selected[i % selected.size()], ddIndexHandle, stats, config);
+            
+            stats.endRun();
             
             CheckHandleType::check(ddIndexHandle);
         }
+        
+        return stats.results();
+    }
+    
+    /*
+     * Records a trace of a fresh index filled to config.indexSize followed by operations ops of
+     * the config's workload mix and distribution.
+     */
+    template<typename IdxType, typename IndexObj>
+    static bool recordTrace(const DDBenchmarkConfig& config, const std::string& path, size_t operations)
+    {
+        typedef DDIndex<IdxType, IndexObj> IndexType;
+        
+        DDOpTrace::Writer writer(path, sizeof(IdxType), sizeof(IndexObj));
+        if (!writer.isOpen()) return false;
+        
+        IndexType index(2, 0, 1, 2);
+        DDTracingIndex<IdxType, IndexObj, IndexType> traced(index, writer);
+        
+        for (size_t i=0; i<config.indexSize; i++)
+        {
+            traced.insertIdx((IdxType)i, IndexObj::rand());
+        }
+        
+        DDWorkloadGen workload(config.workload, config.seed);
+        
+        for (size_t i=0; i<operations; i++)
+        {
+            IdxType size = traced.size();
+            DDWorkloadGen::Op op = workload.op();
+            
+            if (op == DDWorkloadGen::Insert || size == 0) traced.insertIdx((IdxType)workload.position(size + 1), IndexObj::rand());
+            else if (op == DDWorkloadGen::Read) traced.get((IdxType)workload.position(size));
+            else traced.deleteIdx((IdxType)workload.position(size));
+        }
+        
+        writer.flush();
+        index.unpersist();
+        
+        return true;
+    }
+    
+    //replays a trace against a fresh DDIndex with Traits, traitsName is appended to the result name.
+    template<typename IdxType, typename IndexObj, class Traits = DDIndexTraits<IndexObj>>
+    static std::vector<DDBenchmarkResult> replayTrace(const std::string& path, bool recordedSpeed, size_t latencySampleRate, bool printText = true, const std::string& traitsName = "")
+    {
+        typedef DDBenchmarks<IdxType, IndexObj> BenchmarkType;
+        
+        typename BenchmarkType::Stats stats(latencySampleRate, printText);
+        DDOpTrace::Reader reader(path);
+        
+        if (reader.valid())
+        {
+            stats.beginRun();
+            
+            DDIndex<IdxType, IndexObj, Traits> index(2, 0, 1, 2);
+            
+            DDOpTrace::ReplayResult replay = DDOpTrace::replay<IdxType, IndexObj>(reader, index, recordedSpeed, latencySampleRate);
+            index.finish();
+            
+            std::string name = recordedSpeed ? "TraceReplayRecordedSpeed" : "TraceReplayMaxSpeed";
+            if (!traitsName.empty()) name += "_" + traitsName;
+            
+            stats.replayRes(name, replay);
+            stats.endRun();
+            
+            index.unpersist();
+        }
+        
+        return stats.results();
     }
 };
 
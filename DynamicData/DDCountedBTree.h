@@ -0,0 +1,266 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDCountedBTree_h
+#define DynamicData_DDCountedBTree_h
+
+#include <vector>
+#include <memory>
+#include <cassert>
+
+/*
+ * B+tree addressed by position. Every node knows the number of values below it, so get, insert
+ * and erase are O(log N). Leaves hold up to LeafSize values, inner nodes up to Fanout children,
+ * nodes which drop below a quarter are merged into a neighbour if it has room.
+ */
+template<typename T, size_t LeafSize = (sizeof(T) >= 256 ? 16 : 4096 / sizeof(T)), size_t Fanout = 64>
+class DDCountedBTree
+{
+    static_assert(LeafSize >= 4 && Fanout >= 4, "DDCountedBTree error node size < 4");
+    
+public:
+    
+    DDCountedBTree() : _root(new Node(true)) {}
+    
+    DDCountedBTree(const DDCountedBTree&) = delete;
+    const DDCountedBTree& operator=(const DDCountedBTree&) = delete;
+    
+    size_t size() const { return _root->count; }
+    
+    const T& get(size_t idx) const
+    {
+        assert(idx < size());
+        
+        const Node* node = _root.get();
+        
+        while (!node->leaf)
+        {
+            size_t i = childAt(node, idx);
+            node = node->children[i].get();
+        }
+        
+        return node->values[idx];
+    }
+    
+    void insert(size_t idx, const T& value)
+    {
+        assert(idx <= size());
+        
+        std::unique_ptr<Node> sibling = insert(_root.get(), idx, value);
+        
+        if (sibling)
+        {
+            std::unique_ptr<Node> root(new Node(false));
+            root->count = _root->count + sibling->count;
+            root->children.push_back(std::move(_root));
+            root->children.push_back(std::move(sibling));
+            
+            _root = std::move(root);
+        }
+    }
+    
+    void erase(size_t idx)
+    {
+        assert(idx < size());
+        
+        erase(_root.get(), idx);
+        
+        while (!_root->leaf && _root->children.size() == 1)
+        {
+            std::unique_ptr<Node> child = std::move(_root->children[0]);
+            _root = std::move(child);
+        }
+        
+        if (!_root->leaf && _root->children.empty()) _root.reset(new Node(true));
+    }
+    
+    void clear()
+    {
+        _root.reset(new Node(true));
+    }
+    
+    //bytes of the nodes and their arrays.
+    size_t memoryBytes() const
+    {
+        return memoryBytes(_root.get());
+    }
+    
+private:
+    
+    class Node
+    {
+    public:
+        Node(bool leaf) : leaf(leaf), count(0)
+        {
+            if (leaf) values.reserve(LeafSize + 1);
+            else children.reserve(Fanout + 1);
+        }
+        
+        bool leaf;
+        size_t count;
+        std::vector<T> values;
+        std::vector<std::unique_ptr<Node>> children;
+        
+        size_t entries() const { return leaf ? values.size() : children.size(); }
+    };
+    
+    std::unique_ptr<Node> _root;
+    
+    //child holding idx, idx becomes the position inside of it.
+    static size_t childAt(const Node* node, size_t& idx)
+    {
+        size_t last = node->children.size() - 1;
+        
+        for (size_t i=0; i<last; i++)
+        {
+            if (idx < node->children[i]->count) return i;
+            idx -= node->children[i]->count;
+        }
+        
+        return last;
+    }
+    
+    //returns the upper half if the node was split.
+    std::unique_ptr<Node> insert(Node* node, size_t idx, const T& value)
+    {
+        node->count++;
+        
+        if (node->leaf)
+        {
+            node->values.insert(node->values.begin() + idx, value);
+            
+            if (node->values.size() <= LeafSize) return std::unique_ptr<Node>();
+            
+            //appends leave full nodes behind.
+            size_t keep = idx == LeafSize ? LeafSize : node->values.size() / 2;
+            
+            std::unique_ptr<Node> sibling(new Node(true));
+            sibling->values.assign(node->values.begin() + keep, node->values.end());
+            node->values.resize(keep);
+            
+            sibling->count = sibling->values.size();
+            node->count = node->values.size();
+            
+            return sibling;
+        }
+        
+        size_t i = childAt(node, idx);
+        std::unique_ptr<Node> childSibling = insert(node->children[i].get(), idx, value);
+        
+        if (!childSibling) return std::unique_ptr<Node>();
+        
+        node->children.insert(node->children.begin() + i + 1, std::move(childSibling));
+        
+        if (node->children.size() <= Fanout) return std::unique_ptr<Node>();
+        
+        size_t keep = i + 1 == Fanout ? Fanout : node->children.size() / 2;
+        
+        std::unique_ptr<Node> sibling(new Node(false));
+        
+        for (size_t j=keep; j<node->children.size(); j++)
+        {
+            sibling->count += node->children[j]->count;
+            sibling->children.push_back(std::move(node->children[j]));
+        }
+        
+        node->children.resize(keep);
+        node->count -= sibling->count;
+        
+        return sibling;
+    }
+    
+    void erase(Node* node, size_t idx)
+    {
+        node->count--;
+        
+        if (node->leaf)
+        {
+            node->values.erase(node->values.begin() + idx);
+            return;
+        }
+        
+        size_t i = childAt(node, idx);
+        Node* child = node->children[i].get();
+        
+        erase(child, idx);
+        
+        if (child->count == 0)
+        {
+            node->children.erase(node->children.begin() + i);
+            return;
+        }
+        
+        size_t capacity = child->leaf ? LeafSize : Fanout;
+        
+        if (child->entries() >= capacity / 4) return;
+        
+        if (i + 1 < node->children.size() && child->entries() + node->children[i + 1]->entries() <= capacity)
+        {
+            mergeInto(child, node->children[i + 1].get());
+            node->children.erase(node->children.begin() + i + 1);
+        }
+        else if (i > 0 && node->children[i - 1]->entries() + child->entries() <= capacity)
+        {
+            mergeInto(node->children[i - 1].get(), child);
+            node->children.erase(node->children.begin() + i);
+        }
+    }
+    
+    //appends the entries of right to left.
+    static void mergeInto(Node* left, Node* right)
+    {
+        if (left->leaf)
+        {
+            left->values.insert(left->values.end(), right->values.begin(), right->values.end());
+        }
+        else
+        {
+            for (auto itr = right->children.begin(); itr != right->children.end(); itr++)
+            {
+                left->children.push_back(std::move(*itr));
+            }
+        }
+        
+        left->count += right->count;
+    }
+    
+    static size_t memoryBytes(const Node* node)
+    {
+        size_t bytes = sizeof(Node) + node->values.capacity() * sizeof(T) + node->children.capacity() * sizeof(std::unique_ptr<Node>);
+        
+        for (auto itr = node->children.begin(); itr != node->children.end(); itr++)
+        {
+            bytes += memoryBytes(itr->get());
+        }
+        
+        return bytes;
+    }
+};
+
+#endif
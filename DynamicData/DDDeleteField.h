@@ -32,6 +32,7 @@
 #define DynamicData_DDDeleteField_h
 
 #include <set>
+#include <limits>
 #include "DDFieldIterator.h"
 
 template<typename IdxType>
@@ -227,6 +228,22 @@ public:
         return idx;
     }
     
+    //like eval, length is the distance to the next delete.
+    IdxType evalRun(IdxType idx, IdxType& length)
+    {
+        auto itr = _set.upper_bound(CompoundElement(idx));
+        
+        length = itr != _set.end() ? itr->idx() - idx : std::numeric_limits<IdxType>::max();
+        
+        if (itr != _set.begin())
+        {
+            itr--;
+            idx += itr->diff();
+        }
+        
+        return idx;
+    }
+    
     void clear()
     {
         _set.clear();
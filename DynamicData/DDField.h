@@ -31,6 +31,7 @@
 #define DynamicData_DDField_h
 
 #include <utility>
+#include <limits>
 
 #include "DDInsertField.h"
 #include "DDDeleteField.h"
@@ -40,12 +41,13 @@ class DDField
 {
 public:
     
-    DDField() : _fieldSize(0) {}
+    DDField() : _fieldSize(0), _insertSize(0) {}
     
     DDField(DDField<IdxType, CachedElement>&& other) :
         _insertField(std::forward<DDInsertField<IdxType, CachedElement>>(other._insertField)),
         _deleteField(std::forward<DDDeleteField<IdxType>>(other._deleteField)),
-        _fieldSize(other._fieldSize)
+        _fieldSize(other._fieldSize),
+        _insertSize(other._insertSize)
     {}
     
     //TODO implement.
@@ -56,6 +58,7 @@ public:
         _insertField = std::forward<DDInsertField<IdxType, CachedElement>>(rhs._insertField);
         _deleteField = std::forward<DDDeleteField<IdxType>>(rhs._deleteField);
         _fieldSize = rhs._fieldSize;
+        _insertSize = rhs._insertSize;
     }
     
     DDField(const DDField&) = delete;
@@ -69,6 +72,7 @@ public:
         _insertField.addIdx(idx, cachedElement);
         
         _fieldSize++;
+        _insertSize++;
     }
     
     void deleteIdx(IdxType idx)
@@ -90,6 +94,27 @@ public:
         return idx;
     }
     
+    //like eval, length is the number of positions from idx on which map onto consecutive positions.
+    IdxType evalRun(IdxType idx, IdxType& length, bool& hasCacheElement, CachedElement& cachedElement)
+    {
+        if (_fieldSize > 0)
+        {
+            IdxType deleteLength;
+            
+            idx = _deleteField.evalRun(idx, deleteLength);
+            idx = _insertField.evalRun(idx, length, hasCacheElement, cachedElement);
+            
+            if (deleteLength < length) length = deleteLength;
+        }
+        else
+        {
+            hasCacheElement = false;
+            length = std::numeric_limits<IdxType>::max();
+        }
+        
+        return idx;
+    }
+    
     void startItr()
     {
         _insertField.fieldItr.startItr();
@@ -111,11 +136,17 @@ public:
         return _insertField.fieldItr.itrEval(idx, hasCacheElement, cachedElement);
     }
     
+    IdxType itrEvalAndStep(bool& hasCacheElement, CachedElement& cachedElement)
+    {
+        return insertFieldEval(deleteFieldItrEvalAndStep(), hasCacheElement, cachedElement);
+    }
+    
     void clear()
     {
         _insertField.clear();
         _deleteField.clear();
         _fieldSize = 0;
+        _insertSize = 0;
     }
     
     size_t size()
@@ -123,10 +154,40 @@ public:
         return _fieldSize;
     }
     
+    //rough estimate of the heap memory of the operations.
+    size_t memoryBytes() const
+    {
+        return _fieldSize * OpOverheadBytes + _insertSize * sizeof(CachedElement);
+    }
+    
+    typedef typename DDInsertField<IdxType, CachedElement>::WalkStats WalkStats;
+    
+    static const IdxType DefaultWindowWidth = DDInsertField<IdxType, CachedElement>::DefaultWindowWidth;
+    
+    //the new window width only affects buckets which are split from now on.
+    void setWindowWidth(IdxType windowWidth)
+    {
+        _insertField.setWindowWidth(windowWidth);
+    }
+    
+    IdxType windowWidth() const
+    {
+        return _insertField.windowWidth();
+    }
+    
+    const WalkStats& walkStats() const
+    {
+        return _insertField.walkStats();
+    }
+    
 private:
     DDInsertField<IdxType, CachedElement> _insertField;
     DDDeleteField<IdxType> _deleteField;
     size_t _fieldSize;
+    size_t _insertSize;
+    
+    //tree node and bookkeeping per operation.
+    static const size_t OpOverheadBytes = 48;
 };
 
 
@@ -0,0 +1,96 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDFieldBudget_h
+#define DynamicData_DDFieldBudget_h
+
+#include <atomic>
+
+#include "DDUtils.h"
+
+/*
+ * Process wide memory budget for the pending fields of all indexes. Every index reports the
+ * estimated bytes of its active field, an index whose field is at least MinSpillBytes big spills
+ * it to a run file while the total is over the budget. 0 means unlimited.
+ */
+class DDFieldBudget
+{
+public:
+    
+    static const size_t MinSpillBytes = 256 << 10;
+    
+    DDFieldBudget() :
+        _maxBytes(0),
+        _bytes(0)
+    {}
+    
+    DDFieldBudget(const DDFieldBudget&) = delete;
+    const DDFieldBudget& operator=(const DDFieldBudget&) = delete;
+    
+    static DDFieldBudget* SHARED()
+    {
+        return DDUtils::SHARED<DDFieldBudget>();
+    }
+    
+    void setMaxBytes(size_t maxBytes)
+    {
+        _maxBytes.store(maxBytes, std::memory_order_relaxed);
+    }
+    
+    size_t maxBytes()
+    {
+        return _maxBytes.load(std::memory_order_relaxed);
+    }
+    
+    //an index changes its field from oldBytes to newBytes.
+    void update(size_t oldBytes, size_t newBytes)
+    {
+        if (newBytes > oldBytes) _bytes.fetch_add(newBytes - oldBytes, std::memory_order_relaxed);
+        else _bytes.fetch_sub(oldBytes - newBytes, std::memory_order_relaxed);
+    }
+    
+    size_t bytes()
+    {
+        return _bytes.load(std::memory_order_relaxed);
+    }
+    
+    //true if a field of fieldBytes should be spilled.
+    bool shouldSpill(size_t fieldBytes)
+    {
+        size_t maxBytes = _maxBytes.load(std::memory_order_relaxed);
+        
+        return maxBytes > 0 && fieldBytes >= MinSpillBytes && _bytes.load(std::memory_order_relaxed) > maxBytes;
+    }
+    
+private:
+    std::atomic<size_t> _maxBytes;
+    std::atomic<size_t> _bytes;
+};
+
+#endif
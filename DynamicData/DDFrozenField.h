@@ -0,0 +1,483 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDFrozenField_h
+#define DynamicData_DDFrozenField_h
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Immutable pending operations as a sorted run of pieces on disk. A piece maps the positions
+ * [start, start + length) either onto the positions [source, source + length) of the layer below
+ * or onto the cached elements [source, source + length). The run files are unlinked once they
+ * are mapped, only a summary of every SummaryStride-th piece start stays in memory.
+ *
+ * freeze evaluates a field (DDField or DDFrozenField) run by run and resolves it through an
+ * optional frozen field below, so the pieces cost O(P log P) for P operations, not O(N).
+ */
+template<typename IdxType, class CachedElement>
+class DDFrozenField
+{
+public:
+    
+    class Piece
+    {
+    public:
+        IdxType start;
+        IdxType length;
+        IdxType source;
+        bool cached;
+    };
+    
+private:
+    
+    static const size_t SummaryStride = 64;
+    
+    //append only file which is mapped read only when it is complete.
+    template<typename Type>
+    class RunFile
+    {
+    public:
+        RunFile(const std::string& path) :
+            _path(path),
+            _size(0),
+            _map(0),
+            _mapBytes(0)
+        {
+            _fileDesc = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+            
+            if (_fileDesc == -1)
+            {
+                std::cout << "DDFrozenField: error opening run file " << _path << std::endl;
+                exit(1);
+            }
+            
+            _buffer.reserve(BufferSize);
+        }
+        
+        ~RunFile()
+        {
+            if (_map) munmap(_map, _mapBytes);
+            if (_fileDesc != -1) close(_fileDesc);
+        }
+        
+        RunFile(const RunFile&) = delete;
+        const RunFile& operator=(const RunFile&) = delete;
+        
+        void append(const Type& value)
+        {
+            _buffer.push_back(value);
+            _size++;
+            
+            if (_buffer.size() == BufferSize) write();
+        }
+        
+        void finish()
+        {
+            write();
+            
+            _mapBytes = _size * sizeof(Type);
+            
+            if (_mapBytes > 0)
+            {
+                _map = mmap(0, _mapBytes, PROT_READ, MAP_SHARED, _fileDesc, 0);
+                
+                if (_map == MAP_FAILED)
+                {
+                    std::cout << "DDFrozenField: error mapping run file " << _path << std::endl;
+                    exit(1);
+                }
+            }
+            
+            //the mapping keeps the data alive.
+            close(_fileDesc);
+            _fileDesc = -1;
+            unlink(_path.c_str());
+            
+            std::vector<Type>().swap(_buffer);
+        }
+        
+        const Type& operator[](size_t idx) const
+        {
+            return ((const Type*)_map)[idx];
+        }
+        
+        size_t size() const
+        {
+            return _size;
+        }
+        
+        size_t bytes() const
+        {
+            return _mapBytes;
+        }
+        
+    private:
+        static const size_t BufferSize = (64 << 10) / sizeof(Type) + 1;
+        
+        std::string _path;
+        int _fileDesc;
+        std::vector<Type> _buffer;
+        size_t _size;
+        void* _map;
+        size_t _mapBytes;
+        
+        void write()
+        {
+            const char* data = (const char*)_buffer.data();
+            size_t bytes = _buffer.size() * sizeof(Type);
+            
+            while (bytes > 0)
+            {
+                ssize_t written = ::write(_fileDesc, data, bytes);
+                
+                if (written <= 0)
+                {
+                    std::cout << "DDFrozenField: error writing run file " << _path << std::endl;
+                    exit(1);
+                }
+                
+                data += written;
+                bytes -= written;
+            }
+            
+            _buffer.clear();
+        }
+    };
+    
+public:
+    
+    typedef std::unique_ptr<DDFrozenField> Ptr;
+    
+    DDFrozenField(const std::string& path, size_t ops) :
+        _pieces(path + ".pieces"),
+        _cachedElements(path + ".elements"),
+        _size(0),
+        _ops(ops)
+    {}
+    
+    DDFrozenField(const DDFrozenField&) = delete;
+    const DDFrozenField& operator=(const DDFrozenField&) = delete;
+    
+    //a new run file name in the data folder.
+    static std::string runPath(size_t scopeVal, size_t idVal)
+    {
+        static std::atomic<size_t> runCount(0);
+        
+        std::stringstream path;
+        path << "data/run_scope_" << scopeVal << "_id_" << idVal << "_" << getpid() << "_" << runCount.fetch_add(1) << ".bin";
+        return path.str();
+    }
+    
+    /*
+     * Freezes the first size positions of top. Positions which top maps onto the layer below are
+     * resolved through below if there is one. ops is the number of operations the result stands for.
+     */
+    template<class Field>
+    static Ptr freeze(Field& top, IdxType size, const DDFrozenField* below, size_t ops, const std::string& path)
+    {
+        Ptr frozen(new DDFrozenField(path, ops));
+        
+        IdxType idx = 0;
+        
+        while (idx < size)
+        {
+            IdxType length;
+            bool hasCacheElement;
+            CachedElement cachedElement;
+            
+            IdxType mappedIdx = top.evalRun(idx, length, hasCacheElement, cachedElement);
+            
+            if (length > size - idx) length = size - idx;
+            
+            if (hasCacheElement)
+            {
+                frozen->addCached(cachedElement);
+                length = 1;
+            }
+            else if (!below)
+            {
+                frozen->add(mappedIdx, length);
+            }
+            else
+            {
+                IdxType belowIdx = 0;
+                
+                while (belowIdx < length)
+                {
+                    IdxType belowLength;
+                    IdxType belowMappedIdx = below->evalRun(mappedIdx + belowIdx, belowLength, hasCacheElement, cachedElement);
+                    
+                    if (hasCacheElement)
+                    {
+                        frozen->addCached(cachedElement);
+                        belowLength = 1;
+                    }
+                    else
+                    {
+                        if (belowLength > length - belowIdx) belowLength = length - belowIdx;
+                        frozen->add(belowMappedIdx, belowLength);
+                    }
+                    
+                    belowIdx += belowLength;
+                }
+            }
+            
+            idx += length;
+        }
+        
+        frozen->finish();
+        
+        return frozen;
+    }
+    
+    IdxType eval(IdxType idx, bool& hasCacheElement, CachedElement& cachedElement) const
+    {
+        IdxType length;
+        return evalRun(idx, length, hasCacheElement, cachedElement);
+    }
+    
+    //like eval, length is the number of positions from idx on which map onto consecutive positions.
+    IdxType evalRun(IdxType idx, IdxType& length, bool& hasCacheElement, CachedElement& cachedElement) const
+    {
+        assert(idx < _size);
+        
+        const Piece& piece = _pieces[findPiece(idx)];
+        IdxType offset = idx - piece.start;
+        
+        length = piece.length - offset;
+        hasCacheElement = piece.cached;
+        
+        if (piece.cached)
+        {
+            cachedElement = _cachedElements[piece.source + offset];
+            return idx;
+        }
+        
+        return piece.source + offset;
+    }
+    
+    //sequential evaluation for the merge.
+    class Cursor
+    {
+    public:
+        Cursor(const DDFrozenField& frozen) :
+            _frozen(frozen),
+            _pieceIdx(0),
+            _offset(0)
+        {}
+        
+        IdxType itrEvalAndStep(bool& hasCacheElement, CachedElement& cachedElement)
+        {
+            const Piece& piece = _frozen._pieces[_pieceIdx];
+            IdxType offset = _offset;
+            
+            if (++_offset == piece.length)
+            {
+                _pieceIdx++;
+                _offset = 0;
+            }
+            
+            hasCacheElement = piece.cached;
+            
+            if (piece.cached)
+            {
+                cachedElement = _frozen._cachedElements[piece.source + offset];
+                return 0;
+            }
+            
+            return piece.source + offset;
+        }
+        
+    private:
+        const DDFrozenField& _frozen;
+        size_t _pieceIdx;
+        IdxType _offset;
+    };
+    
+    //the positions of the layer below in [0, belowSize) which no piece maps onto, in ascending order.
+    std::vector<IdxType> unmappedIdxs(IdxType belowSize) const
+    {
+        std::vector<std::pair<IdxType, IdxType>> ranges;
+        
+        for (size_t i = 0; i < _pieces.size(); i++)
+        {
+            if (!_pieces[i].cached) ranges.push_back(std::make_pair(_pieces[i].source, _pieces[i].length));
+        }
+        
+        std::sort(ranges.begin(), ranges.end());
+        
+        std::vector<IdxType> idxs;
+        IdxType idx = 0;
+        
+        for (auto itr = ranges.begin(); itr != ranges.end(); itr++)
+        {
+            for (; idx < itr->first && idx < belowSize; idx++) idxs.push_back(idx);
+            if (itr->first + itr->second > idx) idx = itr->first + itr->second;
+        }
+        
+        for (; idx < belowSize; idx++) idxs.push_back(idx);
+        
+        return idxs;
+    }
+    
+    size_t cachedElements() const
+    {
+        return _cachedElements.size();
+    }
+    
+    const CachedElement& cachedElement(size_t idx) const
+    {
+        return _cachedElements[idx];
+    }
+    
+    //number of positions.
+    IdxType size() const
+    {
+        return _size;
+    }
+    
+    size_t ops() const
+    {
+        return _ops;
+    }
+    
+    size_t pieces() const
+    {
+        return _pieces.size();
+    }
+    
+    size_t memoryBytes() const
+    {
+        return _summary.capacity() * sizeof(IdxType);
+    }
+    
+    size_t fileBytes() const
+    {
+        return _pieces.bytes() + _cachedElements.bytes();
+    }
+    
+private:
+    RunFile<Piece> _pieces;
+    RunFile<CachedElement> _cachedElements;
+    std::vector<IdxType> _summary;
+    
+    //the piece which is not yet written.
+    Piece _piece;
+    
+    IdxType _size;
+    size_t _ops;
+    
+    void add(IdxType source, IdxType length)
+    {
+        if (_size > 0 && !_piece.cached && _piece.source + _piece.length == source)
+        {
+            _piece.length += length;
+        }
+        else
+        {
+            startPiece(source, false);
+            _piece.length = length;
+        }
+        
+        _size += length;
+    }
+    
+    void addCached(const CachedElement& cachedElement)
+    {
+        if (_size > 0 && _piece.cached)
+        {
+            _piece.length++;
+        }
+        else
+        {
+            startPiece(_cachedElements.size(), true);
+            _piece.length = 1;
+        }
+        
+        _cachedElements.append(cachedElement);
+        _size++;
+    }
+    
+    void startPiece(IdxType source, bool cached)
+    {
+        if (_size > 0) appendPiece();
+        
+        _piece.start = _size;
+        _piece.source = source;
+        _piece.cached = cached;
+    }
+    
+    void appendPiece()
+    {
+        if (_pieces.size() % SummaryStride == 0) _summary.push_back(_piece.start);
+        _pieces.append(_piece);
+    }
+    
+    void finish()
+    {
+        if (_size > 0) appendPiece();
+        
+        _pieces.finish();
+        _cachedElements.finish();
+        _summary.shrink_to_fit();
+    }
+    
+    size_t findPiece(IdxType idx) const
+    {
+        size_t block = std::upper_bound(_summary.begin(), _summary.end(), idx) - _summary.begin() - 1;
+        
+        size_t low = block * SummaryStride;
+        size_t high = std::min(low + SummaryStride, _pieces.size());
+        
+        //the last piece in the block which starts at or before idx.
+        while (high - low > 1)
+        {
+            size_t mid = (low + high) / 2;
+            
+            if (_pieces[mid].start <= idx) low = mid;
+            else high = mid;
+        }
+        
+        return low;
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDHistogram_h
+#define DynamicData_DDHistogram_h
+
+#include <limits>
+#include <algorithm>
+
+/*
+ * Log-linear histogram: every power of two is split into SubBuckets linear buckets,
+ * so a recorded value is off by at most 1/SubBuckets (~3%). Recording is a couple of
+ * shifts and an increment, not thread safe; keep one per thread and merge them.
+ */
+class DDHistogram
+{
+public:
+    
+    typedef unsigned long long ValueType;
+    
+    DDHistogram()
+    {
+        reset();
+    }
+    
+    void reset()
+    {
+        std::fill(_buckets, _buckets + NumOfBuckets, 0);
+        
+        _count = 0;
+        _sum = 0;
+        _min = std::numeric_limits<ValueType>::max();
+        _max = 0;
+    }
+    
+    void record(ValueType value)
+    {
+        _buckets[bucketIdx(value)]++;
+        
+        _count++;
+        _sum += value;
+        
+        if (value < _min) _min = value;
+        if (value > _max) _max = value;
+    }
+    
+    void merge(const DDHistogram& other)
+    {
+        for (size_t i=0; i<NumOfBuckets; i++) _buckets[i] += other._buckets[i];
+        
+        _count += other._count;
+        _sum += other._sum;
+        
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+    }
+    
+    ValueType count() const { return _count; }
+    ValueType min() const { return _count > 0 ? _min : 0; }
+    ValueType max() const { return _max; }
+    
+    double mean() const
+    {
+        return _count > 0 ? (double)_sum / (double)_count : 0;
+    }
+    
+    //the highest value of the bucket which holds the given percentile (0-100).
+    ValueType percentile(double percent) const
+    {
+        if (_count == 0) return 0;
+        
+        ValueType rank = (ValueType)(percent / 100.0 * (double)_count + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > _count) rank = _count;
+        
+        ValueType seen = 0;
+        
+        for (size_t i=0; i<NumOfBuckets; i++)
+        {
+            seen += _buckets[i];
+            
+            if (seen >= rank) return std::min(bucketMax(i), _max);
+        }
+        
+        return _max;
+    }
+    
+private:
+    static const unsigned int SubBucketBits = 5;
+    static const ValueType SubBuckets = 1 << SubBucketBits;
+    
+    //bucket 0 holds the values below SubBuckets one by one, every further one a power of two.
+    static const size_t NumOfBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+    
+    ValueType _buckets[NumOfBuckets];
+    
+    ValueType _count;
+    ValueType _sum;
+    ValueType _min;
+    ValueType _max;
+    
+    static size_t bucketIdx(ValueType value)
+    {
+        if (value < SubBuckets) return (size_t)value;
+        
+        unsigned int msb = 63 - __builtin_clzll(value);
+        unsigned int shift = msb - SubBucketBits;
+        
+        return (size_t)(((shift + 1) << SubBucketBits) + ((value >> shift) & (SubBuckets - 1)));
+    }
+    
+    static ValueType bucketMax(size_t idx)
+    {
+        ValueType exp = idx >> SubBucketBits;
+        ValueType sub = idx & (SubBuckets - 1);
+        
+        if (exp == 0) return sub;
+        
+        return ((SubBuckets + sub + 1) << (exp - 1)) - 1;
+    }
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDImplicitTreap_h
+#define DynamicData_DDImplicitTreap_h
+
+#include <cstdint>
+#include <vector>
+#include <cassert>
+
+/*
+ * Sequence with O(log N) expected insert, erase and get by position. The nodes live in one vector
+ * and link by index, erased nodes are reused. Used as the reference model of the assert tests.
+ */
+template<typename T>
+class DDImplicitTreap
+{
+public:
+    
+    DDImplicitTreap() :
+        _root(Nil),
+        _free(Nil),
+        _random(0x9E3779B97F4A7C15ULL)
+    {}
+    
+    size_t size() const { return count(_root); }
+    
+    void insert(size_t idx, const T& value)
+    {
+        assert(idx <= size());
+        
+        uint32_t node = allocate(value);
+        uint32_t left, right;
+        
+        split(_root, idx, left, right);
+        _root = merge(merge(left, node), right);
+    }
+    
+    void erase(size_t idx)
+    {
+        assert(idx < size());
+        
+        uint32_t left, middle, right;
+        
+        split(_root, idx, left, right);
+        split(right, 1, middle, right);
+        
+        release(middle);
+        _root = merge(left, right);
+    }
+    
+    const T& get(size_t idx) const
+    {
+        assert(idx < size());
+        
+        uint32_t node = _root;
+        
+        while (true)
+        {
+            size_t leftCount = count(_nodes[node].left);
+            
+            if (idx < leftCount)
+            {
+                node = _nodes[node].left;
+            }
+            else if (idx == leftCount)
+            {
+                return _nodes[node].value;
+            }
+            else
+            {
+                idx -= leftCount + 1;
+                node = _nodes[node].right;
+            }
+        }
+    }
+    
+    void clear()
+    {
+        _nodes.clear();
+        _root = Nil;
+        _free = Nil;
+    }
+    
+    //calls func(idx, value) in order.
+    template<class Func>
+    void forEach(Func func) const
+    {
+        std::vector<uint32_t> stack;
+        uint32_t node = _root;
+        size_t idx = 0;
+        
+        while (node != Nil || !stack.empty())
+        {
+            while (node != Nil)
+            {
+                stack.push_back(node);
+                node = _nodes[node].left;
+            }
+            
+            node = stack.back();
+            stack.pop_back();
+            
+            func(idx++, _nodes[node].value);
+            
+            node = _nodes[node].right;
+        }
+    }
+    
+private:
+    static const uint32_t Nil = UINT32_MAX;
+    
+    class Node
+    {
+    public:
+        T value;
+        uint32_t priority;
+        uint32_t count;
+        uint32_t left;
+        uint32_t right;
+    };
+    
+    std::vector<Node> _nodes;
+    uint32_t _root;
+    
+    //erased nodes, linked by right.
+    uint32_t _free;
+    uint64_t _random;
+    
+    size_t count(uint32_t node) const
+    {
+        return node == Nil ? 0 : _nodes[node].count;
+    }
+    
+    void update(uint32_t node)
+    {
+        _nodes[node].count = (uint32_t)(1 + count(_nodes[node].left) + count(_nodes[node].right));
+    }
+    
+    uint32_t allocate(const T& value)
+    {
+        _random ^= _random >> 12;
+        _random ^= _random << 25;
+        _random ^= _random >> 27;
+        
+        Node node;
+        node.value = value;
+        node.priority = (uint32_t)((_random * 0x2545F4914F6CDD1DULL) >> 32);
+        node.count = 1;
+        node.left = Nil;
+        node.right = Nil;
+        
+        if (_free == Nil)
+        {
+            _nodes.push_back(node);
+            return (uint32_t)(_nodes.size() - 1);
+        }
+        
+        uint32_t idx = _free;
+        _free = _nodes[idx].right;
+        _nodes[idx] = node;
+        
+        return idx;
+    }
+    
+    void release(uint32_t node)
+    {
+        _nodes[node].right = _free;
+        _free = node;
+    }
+    
+    //left gets the first idx elements.
+    void split(uint32_t node, size_t idx, uint32_t& left, uint32_t& right)
+    {
+        if (node == Nil)
+        {
+            left = Nil;
+            right = Nil;
+            return;
+        }
+        
+        size_t leftCount = count(_nodes[node].left);
+        
+        if (idx <= leftCount)
+        {
+            split(_nodes[node].left, idx, left, _nodes[node].left);
+            right = node;
+        }
+        else
+        {
+            split(_nodes[node].right, idx - leftCount - 1, _nodes[node].right, right);
+            left = node;
+        }
+        
+        update(node);
+    }
+    
+    uint32_t merge(uint32_t left, uint32_t right)
+    {
+        if (left == Nil) return right;
+        if (right == Nil) return left;
+        
+        if (_nodes[left].priority > _nodes[right].priority)
+        {
+            _nodes[left].right = merge(_nodes[left].right, right);
+            update(left);
+            return left;
+        }
+        
+        _nodes[right].left = merge(left, _nodes[right].left);
+        update(right);
+        return right;
+    }
+};
+
+#endif
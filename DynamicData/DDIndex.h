@@ -32,19 +32,60 @@
 #define DynamicData_DDIndex_h
 
 #include <list>
+#include <map>
+#include <deque>
+#include <cstring>
+#include <limits>
+#include <algorithm>
 #include <mutex>
 #include <atomic>
 #include <thread>
+#include <condition_variable>
 #include <vector>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <functional>
 
 #include "DDMMapAllocator.h"
 #include "DDActivePassivePtr.h"
 #include "DDField.h"
+#include "DDMergeTuner.h"
+#include "DDMergeScheduler.h"
+#include "DDMergeThrottle.h"
+#include "DDMetrics.h"
+#include "DDTraceEvents.h"
+#include "DDIndexTraits.h"
+#include "DDFrozenField.h"
+#include "DDFieldBudget.h"
+#include "DDThreadPool.h"
+#include "DDSharedMutex.h"
 
-template<typename IdxType, typename YType>
-class DDIndex
+template<typename IdxType, typename YType, class Traits = DDIndexTraits<YType>>
+class DDIndex : private DDMergeScheduler::Client
 {
 private:
+    
+    static_assert(!(Traits::DirectValues && Traits::StagedValues), "DDIndex error DirectValues can not be staged");
+    
+    typedef std::integral_constant<bool, Traits::DirectValues> DirectValues;
+    typedef std::integral_constant<bool, Traits::StagedValues> StagedValues;
+    typedef std::integral_constant<bool, Traits::SharedReads> SharedReads;
+    typedef std::integral_constant<bool, Traits::JournaledMap> JournaledMap;
+    
+    typedef typename std::conditional<Traits::SharedReads, DDSharedMutex, std::mutex>::type IndexMutex;
+    
+    //the pending inserts hold the values, with StagedValues their offsets into the tail of the value file.
+    typedef typename std::conditional<Traits::StagedValues, IdxType, YType>::type FieldElement;
+    typedef DDField<IdxType, FieldElement> Field;
+    typedef DDFrozenField<IdxType, FieldElement> FrozenField;
+    
+    //offsets into the value file, with DirectValues the values themselves.
+    typedef typename std::conditional<Traits::DirectValues, YType, IdxType>::type MapType;
+    
+    //before the first merge the positions map onto themselves, there are no direct values yet.
+    static MapType unmapped(IdxType idx, std::false_type) { return idx; }
+    static MapType unmapped(IdxType, std::true_type) { return MapType(); }
 
     class DoubleSyncedMMapWrapper
     {
@@ -63,11 +104,15 @@ private:
         };
         
     public:
+        
+        //the back map is resized before a merge writes it, so it is not remapped under the gets.
+        static const bool ConcurrentBackReads = true;
+        
         DoubleSyncedMMapWrapper(size_t scopeVal, size_t idVal1, size_t idVal2) :
             _activeMapIdx(0)
         {
-            _mmapWrapper1 = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<IdxType, MMapHeader>(scopeVal, idVal1);
-            _mmapWrapper2 = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<IdxType, MMapHeader>(scopeVal, idVal2);
+            _mmapWrapper1 = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<MapType, MMapHeader>(scopeVal, idVal1);
+            _mmapWrapper2 = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<MapType, MMapHeader>(scopeVal, idVal2);
             
             bool check = false;
             MMapHeader header = _mmapWrapper1->getUserDataHeader();
@@ -90,8 +135,8 @@ private:
         }
         
         DoubleSyncedMMapWrapper(DoubleSyncedMMapWrapper&& other) :
-            _mmapWrapper1(std::forward<MMapWrapperPtr<IdxType, IdxType, MMapHeader>>(other._mmapWrapper1)),
-            _mmapWrapper2(std::forward<MMapWrapperPtr<IdxType, IdxType, MMapHeader>>(other._mmapWrapper2)),
+            _mmapWrapper1(std::forward<MMapWrapperPtr<IdxType, MapType, MMapHeader>>(other._mmapWrapper1)),
+            _mmapWrapper2(std::forward<MMapWrapperPtr<IdxType, MapType, MMapHeader>>(other._mmapWrapper2)),
             _activeMapIdx(other._activeMapIdx)
         {}
         
@@ -105,13 +150,13 @@ private:
         DoubleSyncedMMapWrapper(const DoubleSyncedMMapWrapper&) = delete;
         const DoubleSyncedMMapWrapper& operator=(const DoubleSyncedMMapWrapper&) = delete;
         
-        IdxType get(IdxType idx)
+        MapType get(IdxType idx)
         {
-            IdxType retIdx;
+            MapType retIdx;
             
             if (_activeMapIdx == 0)
             {
-                retIdx = idx;
+                retIdx = unmapped(idx, DirectValues());
             }
             else if (_activeMapIdx == 1)
             {
@@ -125,15 +170,12 @@ private:
             return retIdx;
         }
         
-        IdxType getBack(IdxType idx)
+        //reads what persist has written.
+        MapType getBack(IdxType idx)
         {
-            IdxType retIdx;
+            MapType retIdx;
             
-            if (_activeMapIdx == 0)
-            {
-                retIdx = idx;
-            }
-            else if (_activeMapIdx == 1)
+            if (_activeMapIdx == 0 || _activeMapIdx == 1)
             {
                 retIdx = _mmapWrapper2->getVal(idx);
             }
@@ -181,7 +223,7 @@ private:
             return size;
         }
         
-        void persist(IdxType idx, IdxType mappedIdx)
+        void persist(IdxType idx, MapType mappedIdx)
         {
             if (_activeMapIdx == 0 || _activeMapIdx == 1)
             {
@@ -205,6 +247,18 @@ private:
             }
         }
         
+        void syncBack(IdxType fromIdx, IdxType toIdx)
+        {
+            if (_activeMapIdx == 0 || _activeMapIdx == 1)
+            {
+                _mmapWrapper2->sync(fromIdx, toIdx);
+            }
+            else
+            {
+                _mmapWrapper1->sync(fromIdx, toIdx);
+            }
+        }
+        
         
         //TODO check this potentially dangerous when application crashes.
         void switchMMaps()
@@ -235,6 +289,41 @@ private:
             }
         }
         
+        size_t fileGrowths()
+        {
+            return _mmapWrapper1->fileGrowths() + _mmapWrapper2->fileGrowths();
+        }
+        
+        //false until the first merge, before that the positions map onto themselves.
+        bool isMapped()
+        {
+            return _activeMapIdx != 0;
+        }
+        
+        //changes the active map in place, only while no merge runs.
+        void persistActive(IdxType idx, MapType mappedIdx)
+        {
+            if (_activeMapIdx == 1)
+            {
+                _mmapWrapper1->persistVal(idx, mappedIdx);
+            }
+            else
+            {
+                _mmapWrapper2->persistVal(idx, mappedIdx);
+            }
+        }
+        
+        size_t fileBytes()
+        {
+            return ((size_t)_mmapWrapper1->fileSize() + _mmapWrapper2->fileSize()) * sizeof(MapType);
+        }
+        
+        //false after unpersist.
+        bool isOpen()
+        {
+            return (bool)_mmapWrapper1;
+        }
+        
         void unpersist()
         {
             _mmapWrapper1->unpersist();
@@ -245,337 +334,1811 @@ private:
         }
         
     private:
-        MMapWrapperPtr<IdxType, IdxType, MMapHeader> _mmapWrapper1;
-        MMapWrapperPtr<IdxType, IdxType, MMapHeader> _mmapWrapper2;
+        MMapWrapperPtr<IdxType, MapType, MMapHeader> _mmapWrapper1;
+        MMapWrapperPtr<IdxType, MapType, MMapHeader> _mmapWrapper2;
         unsigned int _activeMapIdx;
     };
     
-    class YValMapHeader { };
-    
-public:
-    
-    DDIndex(size_t scopeVal, size_t idVal1, size_t idVal2, size_t idVal3) :
-        _doubleSyncedMMapWrapper(scopeVal, idVal1, idVal2),
-        _yValMMapWrapper(DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<YType, YValMapHeader>(scopeVal, idVal3)),
-        _size(_doubleSyncedMMapWrapper.size()),
-        _shoutdownCount(0),
-        _activPassivField(DDField<IdxType, YType>(), DDField<IdxType, YType>()),
-        _reduceAndSwapThread(&DDIndex::reduceAndSwapMap,this)
-    {}
-    
-    DDIndex(DDIndex&& other) :
-        _doubleSyncedMMapWrapper(std::forward<DoubleSyncedMMapWrapper>(other._doubleSyncedMMapWrapper)),
-        _yValMMapWrapper(std::forward<MMapWrapperPtr<IdxType, YType, YValMapHeader>>(other._yValMMapWrapper)),
-        _size(other._size),
-        _shoutdownCount(other._shoutdownCount.fetch_add(0)),
-        _activPassivField(std::forward<DDActivePassivePtr<DDField<IdxType, YType>>>(other._activPassivField)),
-        _reduceAndSwapThread(std::thread(&DDIndex::reduceAndSwapMap,this))
-    {}
-    
-    void operator=(DDIndex&& rhs)
+    /*
+     * One position map plus a journal of the entries a merge changes. The merge collects the changed
+     * ranges in memory, commitBack writes them to the journal file and syncs it, applyBack writes them
+     * into the map. Until then the gets read the changed entries from memory. A committed journal is
+     * applied again on startup.
+     *
+     * The journal is a sequence of runs of IdxType words, [start, length, value] for positions which
+     * map onto consecutive offsets, e.g. the ones shifted by an insert, or [start, length |
+     * ExplicitRun, value, ...] with a value per position. A run only holds the new values, so it can
+     * be applied again after a crash in the middle of applyBack.
+     */
+    class JournaledMMapWrapper
     {
-        finish();
-        rhs.finish();
-     
-        _doubleSyncedMMapWrapper = std::forward<DoubleSyncedMMapWrapper>(rhs._doubleSyncedMMapWrapper);
-        _yValMMapWrapper.swap(rhs._yValMMapWrapper);
-        _size = rhs._size;
-        _shoutdownCount = rhs._shoutdownCount.fetch_add(0);
-        
-        //TODO remove this
-        assert(_shoutdownCount == rhs._shoutdownCount);
+    private:
         
-        _activPassivField = std::forward<DDActivePassivePtr<DDField<IdxType, YType>>>(rhs._activPassivField);
-        _reduceAndSwapThread = std::thread(&DDIndex::reduceAndSwapMap,this);
-    }
-    
-    //TODO make private.
-    void finish()
-    {
-        if (_reduceAndSwapThread.joinable())
+        class MMapHeader
         {
-            _mutex.lock();
-            _mutex.unlock();
-            
-            _shoutdownCount = 2;
+        public:
+            MMapHeader() :
+                done(false)
+            {
+                
+            }
             
-            _reduceAndSwapThread.join();
+            bool done;
+        };
+        
+        class JournalHeader
+        {
+        public:
+            JournalHeader() :
+                committed(false),
+                mapSize(0)
+            {
+                
+            }
             
-            _shoutdownCount = 0;
-        }
-    }
-    
-    ~DDIndex()
-    {
-        finish();
-    }
-    
-    void unpersist()
-    {
-        finish();
+            bool committed;
+            IdxType mapSize;
+        };
         
-        _doubleSyncedMMapWrapper.unpersist();
+        static const IdxType ExplicitRun = (IdxType)1 << (sizeof(IdxType) * 8 - 1);
         
-        _yValMMapWrapper->unpersist();
-        _yValMMapWrapper.reset();
-    }
-    
-    DDIndex(const DDIndex&) = delete;
-    const DDIndex& operator=(const DDIndex&) = delete;
-    
-    YType get(IdxType idx)
-    {
-        YType yVal;
+        //words per value, DirectValues can be bigger than an offset.
+        static const size_t ValueWords = (sizeof(MapType) + sizeof(IdxType) - 1) / sizeof(IdxType);
         
-        assert(idx < _size);
+        //shorter runs of consecutive offsets go into the explicit runs.
+        static const IdxType MinConsecutiveRun = 3;
         
-        if (idx < _size)
+        //the changed entries of the running merge by the first idx of their range.
+        typedef std::map<IdxType, std::vector<MapType>> Ranges;
+        
+    public:
+        
+        //the merge writes the changes into a std::map, they can not be read while it runs.
+        static const bool ConcurrentBackReads = false;
+        
+        JournaledMMapWrapper(size_t scopeVal, size_t idVal1, size_t idVal2) :
+            _mapped(false),
+            _overlay(false),
+            _backSize(0)
         {
-            _mutex.lock();
+            _mmapWrapper = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<MapType, MMapHeader>(scopeVal, idVal1);
+            _journal = DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<IdxType, JournalHeader>(scopeVal, idVal2);
             
-            bool hasCacheElement;
-            idx = _activPassivField->eval(idx, hasCacheElement, yVal);
+            //the last merge stopped after its journal became durable.
+            JournalHeader header = _journal->getUserDataHeader();
             
-            if (!hasCacheElement)
+            if (header.committed)
             {
-                idx = _activPassivField.back().eval(idx, hasCacheElement, yVal);
+                if (header.mapSize > _mmapWrapper->size()) _mmapWrapper->resize(header.mapSize);
+                
+                IdxType word = 0;
                 
-                if (!hasCacheElement)
+                while (word < _journal->size())
                 {
-                    IdxType idx2 = _doubleSyncedMMapWrapper.get(idx);
-                 
+                    IdxType start = _journal->getVal(word++);
+                    IdxType length = _journal->getVal(word++);
+                    
+                    if (length & ExplicitRun)
+                    {
+                        for (IdxType i = 0; i < (length & ~ExplicitRun); i++, word += ValueWords)
+                        {
+                            _mmapWrapper->persistVal(start + i, journalValue(word));
+                        }
+                    }
+                    else
                     {
-                        std::unique_lock<std::mutex> lock(_yValMutex);
-                        yVal = _yValMMapWrapper->getVal(idx2);
+                        MapType value = journalValue(word);
+                        word += ValueWords;
+                        
+                        for (IdxType i = 0; i < length; i++) _mmapWrapper->persistVal(start + i, shifted(value, i, DirectValues()));
                     }
                 }
+                
+                _mmapWrapper->resize(header.mapSize);
+                markApplied();
             }
-
-            _mutex.unlock();
+            
+            _mapped = _mmapWrapper->getUserDataHeader().done;
+            _backSize = size();
         }
         
-        return yVal;
-    }
-    
-    /*
-    void updateIdx(IdxType idx, YType yValue)
-    {
-        if (!_shoutdownCount)
+        JournaledMMapWrapper(JournaledMMapWrapper&& other) :
+            _mmapWrapper(std::forward<MMapWrapperPtr<IdxType, MapType, MMapHeader>>(other._mmapWrapper)),
+            _journal(std::forward<MMapWrapperPtr<IdxType, IdxType, JournalHeader>>(other._journal)),
+            _ranges(std::move(other._ranges)),
+            _mapped(other._mapped),
+            _overlay(other._overlay),
+            _backSize(other._backSize)
+        {}
+        
+        void operator=(JournaledMMapWrapper&& rhs)
         {
-            assert(idx < _size);
+            _mmapWrapper.swap(rhs._mmapWrapper);
+            _journal.swap(rhs._journal);
+            _ranges.swap(rhs._ranges);
+            _mapped = rhs._mapped;
+            _overlay = rhs._overlay;
+            _backSize = rhs._backSize;
+        }
+        
+        JournaledMMapWrapper(const JournaledMMapWrapper&) = delete;
+        const JournaledMMapWrapper& operator=(const JournaledMMapWrapper&) = delete;
+        
+        MapType get(IdxType idx)
+        {
+            if (_overlay)
+            {
+                MapType* value = find(idx);
+                if (value) return *value;
+            }
             
-            _mutex.lock();
+            if (!_mapped) return unmapped(idx, DirectValues());
             
-            FuncData funcData;
+            return _mmapWrapper->getVal(idx);
+        }
+        
+        MapType getBack(IdxType idx)
+        {
+            MapType* value = find(idx);
+            if (value) return *value;
             
-            funcData.closure = [idx, yValue] (IdxType inIdx, bool& hasInsValue, YType& insVal, bool& hasDelValue, IdxType& delVal, bool& hasUpdVal, YType& updVal) -> IdxType
+            if (!_mapped) return unmapped(idx, DirectValues());
+            
+            return _mmapWrapper->getVal(idx);
+        }
+        
+        IdxType size()
+        {
+            return _mapped ? _mmapWrapper->size() : 0;
+        }
+        
+        IdxType backSize()
+        {
+            return _backSize;
+        }
+        
+        void persist(IdxType idx, MapType mappedIdx)
+        {
+            MapType* value = find(idx);
+            
+            if (value)
             {
-                hasInsValue = false;
-                hasDelValue = false;
-                hasUpdVal = false;
+                *value = mappedIdx;
+                return;
+            }
+            
+            //unchanged entries stay out of the journal.
+            if (_mapped && idx < _mmapWrapper->size())
+            {
+                MapType curr = _mmapWrapper->getVal(idx);
+                if (std::memcmp(&curr, &mappedIdx, sizeof(MapType)) == 0) return;
+            }
+            
+            auto itr = _ranges.upper_bound(idx);
+            
+            if (itr != _ranges.begin())
+            {
+                --itr;
                 
-                if (inIdx == idx)
+                if (itr->first + itr->second.size() == idx)
                 {
-                    updVal = yValue;
-                    hasUpdVal = true;
+                    itr->second.push_back(mappedIdx);
+                    return;
                 }
-                
-                return inIdx;
-            };
-            
-            _funcDataVec.push_front(funcData);
+            }
             
-            _mutex.unlock();
+            _ranges[idx].push_back(mappedIdx);
         }
-    }
-    */
-    
-    void insertIdx(IdxType idx, YType yValue)
-    {
-        if (!_shoutdownCount)
+        
+        void resize(IdxType size)
         {
-            assert(idx < _size + 1);
+            _backSize = size;
+        }
+        
+        //writes the changes and the size of resize to the journal and syncs it, called before the switch.
+        void commitBack()
+        {
+            DD_TRACE_SPAN("DDIndex", "journal commit");
             
-            _mutex.lock();
+            std::vector<IdxType> words;
             
-            _activPassivField->insertIdx(idx, yValue);
+            for (auto itr = _ranges.begin(); itr != _ranges.end(); itr++) encode(itr->first, itr->second, words);
             
-            _size++;
+            IdxType count = (IdxType)words.size();
             
-            _mutex.unlock();
-        }
-    }
-    
-    void deleteIdx(IdxType idx)
-    {
-        if (!_shoutdownCount)
-        {
-            assert(idx < _size);
+            _journal->resize(count);
             
-            _mutex.lock();
-         
-            _activPassivField->deleteIdx(idx);
+            for (IdxType i = 0; i < count; i++) _journal->persistVal(i, words[i]);
             
-            _size--;
+            _journal->sync(0, count);
             
-            _mutex.unlock();
+            JournalHeader header;
+            header.committed = true;
+            header.mapSize = _backSize;
+            
+            _journal->saveUserDataHeader(header);
+            _journal->sync(0, 1);
         }
-    }
-    
-    IdxType size()
-    {
-        IdxType size;
-        
-        _mutex.lock();
-        size = _size;
-        _mutex.unlock();
-        
-        return size;
-    }
-    
-private:
-    //XVal Wrapper.
-    DoubleSyncedMMapWrapper _doubleSyncedMMapWrapper;
-    
-    //YVal Wrapper.
-    MMapWrapperPtr<IdxType, YType, YValMapHeader> _yValMMapWrapper;
-    std::mutex _yValMutex;
-    
-    IdxType _size;
-    
-    std::mutex _mutex;
-    
-    std::atomic<int> _shoutdownCount;
-    
-    DDActivePassivePtr<DDField<IdxType, YType>> _activPassivField;
-    
-    std::thread _reduceAndSwapThread;
-    
-    
-    void reduceAndSwapMap()
-    {
-        //return;
         
-        while(true)
+        //called with the mutex of the gets held.
+        void switchMMaps()
         {
-            size_t fieldSize;
-            
-            _mutex.lock();
+            if (_backSize > _mmapWrapper->size()) _mmapWrapper->resize(_backSize);
             
-            fieldSize = _activPassivField->size();
-            
-            _mutex.unlock();
+            _mapped = true;
+            _overlay = true;
+        }
+        
+        //writes the committed changes into the map, the gets read them from memory until done.
+        template<class Mutex>
+        void applyBack(Mutex& mutex)
+        {
+            DD_TRACE_SPAN("DDIndex", "journal apply");
             
-            if (fieldSize > 0)
-            {
-                mapFuncts();
-            }
-            else
+            //the map has been resized by the switch, persistVal does not remap it below its size.
+            for (auto itr = _ranges.begin(); itr != _ranges.end(); itr++)
             {
-                if (_shoutdownCount > 1) _shoutdownCount--;
-                else if (_shoutdownCount == 1) break;
-                else
+                for (IdxType i = 0; i < itr->second.size(); i++)
                 {
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    _mmapWrapper->persistVal(itr->first + i, itr->second[i]);
                 }
             }
-        }
-    }
+            
+            {
+                std::unique_lock<Mutex> lock(mutex);
+                
+                _mmapWrapper->resize(_backSize);
+                _overlay = false;
+                _ranges.clear();
+            }
+            
+            markApplied();
+        }
+        
+        size_t fileGrowths()
+        {
+            return _mmapWrapper->fileGrowths() + _journal->fileGrowths();
+        }
+        
+        //false until the first merge, before that the positions map onto themselves.
+        bool isMapped()
+        {
+            return _mapped;
+        }
+        
+        //changes the map in place, only while no merge runs.
+        void persistActive(IdxType idx, MapType mappedIdx)
+        {
+            _mmapWrapper->persistVal(idx, mappedIdx);
+        }
+        
+        size_t fileBytes()
+        {
+            return (size_t)_mmapWrapper->fileSize() * sizeof(MapType) + (size_t)_journal->fileSize() * sizeof(IdxType);
+        }
+        
+        //false after unpersist.
+        bool isOpen()
+        {
+            return (bool)_mmapWrapper;
+        }
+        
+        void unpersist()
+        {
+            _mmapWrapper->unpersist();
+            _journal->unpersist();
+            
+            _mmapWrapper.reset();
+            _journal.reset();
+        }
+        
+    private:
+        MMapWrapperPtr<IdxType, MapType, MMapHeader> _mmapWrapper;
+        MMapWrapperPtr<IdxType, IdxType, JournalHeader> _journal;
+        
+        Ranges _ranges;
+        
+        bool _mapped;
+        
+        //true between the switch and the end of applyBack.
+        bool _overlay;
+        
+        IdxType _backSize;
+        
+        MapType* find(IdxType idx)
+        {
+            auto itr = _ranges.upper_bound(idx);
+            
+            if (itr == _ranges.begin()) return 0;
+            --itr;
+            
+            if (idx - itr->first < itr->second.size()) return &itr->second[idx - itr->first];
+            
+            return 0;
+        }
+        
+        //appends the runs of a changed range to words.
+        static void encode(IdxType start, const std::vector<MapType>& values, std::vector<IdxType>& words)
+        {
+            //position of the length of the open explicit run, 0 if there is none.
+            size_t explicitLength = 0;
+            
+            IdxType i = 0;
+            
+            while (i < values.size())
+            {
+                IdxType length = consecutive(values, i, DirectValues());
+                
+                if (length >= MinConsecutiveRun)
+                {
+                    words.push_back(start + i);
+                    words.push_back(length);
+                    appendValue(values[i], words);
+                    
+                    explicitLength = 0;
+                }
+                else
+                {
+                    if (!explicitLength)
+                    {
+                        words.push_back(start + i);
+                        words.push_back((IdxType)ExplicitRun);
+                        explicitLength = words.size() - 1;
+                    }
+                    
+                    for (IdxType j = 0; j < length; j++) appendValue(values[i + j], words);
+                    words[explicitLength] += length;
+                }
+                
+                i += length;
+            }
+        }
+        
+        //number of the values from idx on which are consecutive offsets.
+        static IdxType consecutive(const std::vector<MapType>& values, IdxType idx, std::false_type)
+        {
+            IdxType length = 1;
+            
+            while (idx + length < values.size() && values[idx + length] == values[idx + length - 1] + 1) length++;
+            
+            return length;
+        }
+        
+        static IdxType consecutive(const std::vector<MapType>&, IdxType, std::true_type)
+        {
+            return 1;
+        }
+        
+        static MapType shifted(MapType value, IdxType offset, std::false_type)
+        {
+            return value + offset;
+        }
+        
+        //DirectValues only has explicit runs.
+        static MapType shifted(MapType value, IdxType, std::true_type)
+        {
+            return value;
+        }
+        
+        static void appendValue(const MapType& value, std::vector<IdxType>& words)
+        {
+            IdxType buffer[ValueWords] = {};
+            std::memcpy(buffer, &value, sizeof(MapType));
+            
+            words.insert(words.end(), buffer, buffer + ValueWords);
+        }
+        
+        MapType journalValue(IdxType word)
+        {
+            IdxType buffer[ValueWords];
+            for (size_t i = 0; i < ValueWords; i++) buffer[i] = _journal->getVal(word + i);
+            
+            MapType value;
+            std::memcpy(&value, buffer, sizeof(MapType));
+            
+            return value;
+        }
+        
+        //syncs the map and marks it valid before the journal is dropped.
+        void markApplied()
+        {
+            _mmapWrapper->sync(0, _mmapWrapper->size());
+            
+            MMapHeader mapHeader;
+            mapHeader.done = true;
+            _mmapWrapper->saveUserDataHeader(mapHeader);
+            _mmapWrapper->sync(0, 1);
+            
+            _journal->saveUserDataHeader(JournalHeader());
+            _journal->sync(0, 1);
+            _journal->resize(0);
+        }
+    };
     
-    void mapFuncts()
+    typedef typename std::conditional<Traits::JournaledMap, JournaledMMapWrapper, DoubleSyncedMMapWrapper>::type PositionMap;
+    
+    class YValMapHeader { };
+    
+public:
+    
+    DDIndex(size_t scopeVal, size_t idVal1, size_t idVal2, size_t idVal3) :
+        _positionMap(scopeVal, idVal1, idVal2),
+        _yValMMapWrapper(valueMap(scopeVal, idVal3, DirectValues())),
+        _size(_positionMap.size()),
+        _shoutdownCount(0),
+        _mergeTuner(Field::DefaultWindowWidth, DefaultMergeChunkSize),
+        _activPassivField(Field(), Field()),
+        _activeFieldSize(0),
+        _readCount(0),
+        _mergeScheduler(DDMergeScheduler::SHARED()),
+        _registered(false),
+        _autoMerge(true),
+        _reclusterThreshold(0),
+        _reclusterRegionSize(0),
+        _reclusterCursor(0),
+        _activeTailBase(_yValMMapWrapper ? _yValMMapWrapper->size() : 0),
+        _backTailBase(0),
+        _backTailEnd(0),
+        _spillingFieldBytes(0),
+        _maxFieldBytes(0),
+        _level0Ops(0),
+        _level1Ratio(0),
+        _fieldBytes(0),
+        _backFieldBytes(0),
+        _fieldBudget(DDFieldBudget::SHARED()),
+        _scopeVal(scopeVal),
+        _idVal(idVal3),
+        _sealedOps(0),
+        _sealedFieldBytes(0),
+        _sealSize(_size),
+        _writingCore(false),
+        _mergedWatermark(0),
+        _valueEpoch(0),
+        _pipelineDepth(0),
+        _handoffOps(0),
+        _mergeThrottle(DDMergeThrottle::SHARED()),
+        _writeCount(0),
+        _metricsName(metricsName(scopeVal, idVal3)),
+        _metricsRegistry(DDMetricsRegistry::SHARED()),
+        _metricsId(0)
     {
-        IdxType indexSize;
+        //a merge which stopped after its journal commit left the values it appended behind the replayed map.
+        if (_yValMMapWrapper && _yValMMapWrapper->size() > _size)
+        {
+            _yValMMapWrapper->resize(_size);
+            _activeTailBase = _size;
+        }
         
+        registerIndex();
+    }
+    
+    DDIndex(DDIndex&& other) :
+        _positionMap(std::forward<PositionMap>(finished(other)._positionMap)),
+        _yValMMapWrapper(std::forward<MMapWrapperPtr<IdxType, YType, YValMapHeader>>(other._yValMMapWrapper)),
+        _size(other._size),
+        _shoutdownCount(other._shoutdownCount.fetch_add(0)),
+        _mergeTuner(Field::DefaultWindowWidth, DefaultMergeChunkSize),
+        _activPassivField(std::forward<DDActivePassivePtr<Field>>(other._activPassivField)),
+        _activeFieldSize(0),
+        _readCount(0),
+        _mergeScheduler(DDMergeScheduler::SHARED()),
+        _registered(false),
+        _autoMerge(true),
+        _reclusterThreshold(0),
+        _reclusterRegionSize(0),
+        _reclusterCursor(0),
+        _activeTailBase(other._activeTailBase),
+        _backTailBase(other._backTailBase),
+        _backTailEnd(other._backTailEnd),
+        _spillingFieldBytes(0),
+        _maxFieldBytes(other._maxFieldBytes),
+        _level0Ops(other._level0Ops),
+        _level1Ratio(other._level1Ratio),
+        _fieldBytes(0),
+        _backFieldBytes(0),
+        _fieldBudget(DDFieldBudget::SHARED()),
+        _scopeVal(other._scopeVal),
+        _idVal(other._idVal),
+        _sealedOps(0),
+        _sealedFieldBytes(0),
+        _sealSize(_size),
+        _writingCore(false),
+        _mergedWatermark(0),
+        _valueEpoch(0),
+        _pipelineDepth(other._pipelineDepth),
+        _handoffOps(other._handoffOps),
+        _mergeThrottle(DDMergeThrottle::SHARED()),
+        _writeCount(0),
+        _metricsName(other._metricsName),
+        _metricsRegistry(DDMetricsRegistry::SHARED()),
+        _metricsId(0)
+    {
+        registerIndex();
+    }
+    
+    void operator=(DDIndex&& rhs)
+    {
+        finish();
+        rhs.finish();
+     
+        _positionMap = std::forward<PositionMap>(rhs._positionMap);
+        _yValMMapWrapper.swap(rhs._yValMMapWrapper);
+        _size = rhs._size;
+        _shoutdownCount = rhs._shoutdownCount.fetch_add(0);
         
-        _mutex.lock();
+        //TODO remove this
+        assert(_shoutdownCount == rhs._shoutdownCount);
         
-        _activPassivField.swap();
-        DDField<IdxType, YType>& backField = _activPassivField.back();
+        _activPassivField = std::forward<DDActivePassivePtr<Field>>(rhs._activPassivField);
+        _activeTailBase = rhs._activeTailBase;
+        _backTailBase = rhs._backTailBase;
+        _backTailEnd = rhs._backTailEnd;
+        _maxFieldBytes = rhs._maxFieldBytes;
+        _level0Ops = rhs._level0Ops;
+        _level1Ratio = rhs._level1Ratio;
+        _scopeVal = rhs._scopeVal;
+        _idVal = rhs._idVal;
+        _sealSize = _size;
+        _pipelineDepth = rhs._pipelineDepth;
+        _handoffOps = rhs._handoffOps;
         
-        indexSize = _size;
+        _metricsName = rhs._metricsName;
         
-        _mutex.unlock();
+        registerIndex();
+    }
+    
+    //TODO make private.
+    //stops the background merges and merges the pending operations synchronously.
+    void finish()
+    {
+        if (_registered)
+        {
+            //reject new operations until the pending ones are merged.
+            _shoutdownCount = 1;
+            
+            _mergeScheduler->remove(this);
+            _metricsRegistry->remove(_metricsId);
+            _registered = false;
+            
+            std::unique_lock<std::mutex> lock(_mergeMutex);
+            
+            while (pendingSize() > 0)
+            {
+                mapFuncts();
+            }
+            
+            _shoutdownCount = 0;
+        }
+    }
+    
+    ~DDIndex()
+    {
+        finish();
+    }
+    
+    void unpersist()
+    {
+        finish();
         
-
+        _positionMap.unpersist();
         
+        if (_yValMMapWrapper)
+        {
+            _yValMMapWrapper->unpersist();
+            _yValMMapWrapper.reset();
+        }
+    }
+    
+    DDIndex(const DDIndex&) = delete;
+    const DDIndex& operator=(const DDIndex&) = delete;
+    
+    YType get(IdxType idx)
+    {
+        YType yVal;
         
-        //TODO test.
-        IdxType range = 200;
+        assert(idx < _size);
         
-        auto rangeLoop = [] (IdxType range, IdxType size, std::function<void (IdxType idx, IdxType range)> closure)
+        if (idx < _size)
         {
-            IdxType currIdx = 0;
-            bool done = false;
-            while (true)
+            //every LatencySampleRate-th get is timed for the merge throttle and the lock metrics.
+            bool sampleLatency = _readCount.fetch_add(1, std::memory_order_relaxed) % LatencySampleRate == 0;
+            
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point locked;
+            if (sampleLatency) start = std::chrono::steady_clock::now();
+            
+            lockShared(SharedReads());
+            
+            if (sampleLatency) locked = std::chrono::steady_clock::now();
+            
+            DDIndexMetrics::Counter source;
+            
+            IdxType slot = 0;
+            bool inValueFile = resolve(idx, yVal, slot, source);
+            size_t epoch = _valueEpoch.load(std::memory_order_acquire);
+            
+            unlockShared(SharedReads());
+            
+            std::chrono::steady_clock::time_point unlocked;
+            if (sampleLatency) unlocked = std::chrono::steady_clock::now();
+            
+            //a page fault on the value file only holds up this get.
+            if (inValueFile && !readValue(slot, epoch, yVal))
             {
-                if (currIdx + range >= size)
+                //a merge has moved values since the position was resolved.
+                _metrics.add(DDIndexMetrics::LockedValueReads);
+                
+                lockShared(SharedReads());
+                
                 {
-                    done = true;
-                    range = size - currIdx;
+                    //the gap close and the recluster move the values and the back map under _yValMutex.
+                    std::unique_lock<std::mutex> yValLock(_yValMutex);
+                    
+                    if (resolve(idx, yVal, slot, source)) yVal = _yValMMapWrapper->getVal(slot);
                 }
                 
-                closure(currIdx, range);
-                
-                //exit
-                if (done) break;
+                unlockShared(SharedReads());
+            }
+            
+            _metrics.add(source);
+            
+            if (sampleLatency)
+            {
+                std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
                 
-                currIdx += range;
+                recordLockTimes(start, locked, unlocked);
+                _mergeThrottle->observeGetLatency(std::chrono::duration_cast<std::chrono::microseconds>(end - start));
             }
-        };
-        
-        
-        backField.startItr();
-        std::vector<IdxType> deletedIdxs2;
-        std::vector<IdxType> remapIdxs;
+        }
         
-        auto reduceMapOntoDoubleSyncedMMapWrapper = [this, &backField, &deletedIdxs2, &indexSize, &remapIdxs] (IdxType idxIN, IdxType range)
+        return yVal;
+    }
+    
+    /*
+    void updateIdx(IdxType idx, YType yValue)
+    {
+        if (!_shoutdownCount)
         {
-            bool hasCacheElement;
-            YType yObj;
+            assert(idx < _size);
             
-            for (IdxType i = 0; i < range; i++)
+            _mutex.lock();
+            
+            FuncData funcData;
+            
+            funcData.closure = [idx, yValue] (IdxType inIdx, bool& hasInsValue, YType& insVal, bool& hasDelValue, IdxType& delVal, bool& hasUpdVal, YType& updVal) -> IdxType
             {
-                IdxType idx = i + idxIN;
+                hasInsValue = false;
+                hasDelValue = false;
+                hasUpdVal = false;
                 
-                //TODO remove tuple.
-                IdxType ret = backField.deleteFieldItrEvalAndStep();
+                if (inIdx == idx)
+                {
+                    updVal = yValue;
+                    hasUpdVal = true;
+                }
+                
+                return inIdx;
+            };
+            
+            _funcDataVec.push_front(funcData);
+            
+            _mutex.unlock();
+        }
+    }
+    */
+    
+    void insertIdx(IdxType idx, YType yValue)
+    {
+        if (!_shoutdownCount)
+        {
+            assert(idx < _size + 1);
+            
+            bool sampleLock = _writeCount.fetch_add(1, std::memory_order_relaxed) % LatencySampleRate == 0;
+            
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point locked;
+            if (sampleLock) start = std::chrono::steady_clock::now();
+            
+            _mutex.lock();
+            
+            if (sampleLock) locked = std::chrono::steady_clock::now();
+            
+            bool wasEmpty = _activPassivField->size() == 0;
+            
+            _activPassivField->insertIdx(idx, stage(yValue, StagedValues()));
+            
+            _size++;
+            
+            bool notify = accountField(wasEmpty);
+            
+            _mutex.unlock();
+            
+            _metrics.add(DDIndexMetrics::Inserts);
+            if (sampleLock) recordLockTimes(start, locked, std::chrono::steady_clock::now());
+            
+            if (notify) _mergeScheduler->notify(this);
+        }
+    }
+    
+    void deleteIdx(IdxType idx)
+    {
+        if (!_shoutdownCount)
+        {
+            assert(idx < _size);
+            
+            bool sampleLock = _writeCount.fetch_add(1, std::memory_order_relaxed) % LatencySampleRate == 0;
+            
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point locked;
+            if (sampleLock) start = std::chrono::steady_clock::now();
+            
+            _mutex.lock();
+            
+            if (sampleLock) locked = std::chrono::steady_clock::now();
+            
+            bool wasEmpty = _activPassivField->size() == 0;
+            
+            _activPassivField->deleteIdx(idx);
+            
+            _size--;
+            
+            bool notify = accountField(wasEmpty);
+            
+            _mutex.unlock();
+            
+            _metrics.add(DDIndexMetrics::Deletes);
+            if (sampleLock) recordLockTimes(start, locked, std::chrono::steady_clock::now());
+            
+            if (notify) _mergeScheduler->notify(this);
+        }
+    }
+    
+    IdxType size()
+    {
+        IdxType size;
+        
+        lockShared(SharedReads());
+        size = _size;
+        unlockShared(SharedReads());
+        
+        return size;
+    }
+    
+    //window width and merge chunk size, either auto tuned or fixed with setTuning.
+    DDMergeTuner<IdxType>& mergeTuner()
+    {
+        return _mergeTuner;
+    }
+    
+    //merges the operations which are pending now, concurrent background merges wait.
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        //the batches handed off before and the operations on top of them.
+        _mutex.lock();
+        size_t batches = _sealed.size() + 1;
+        _mutex.unlock();
+        
+        for (size_t i = 0; i < batches && pendingSize() > 0; i++)
+        {
+            mapFuncts();
+            reclusterIfFragmented();
+        }
+    }
+    
+    /*
+     * The values are appended in arrival order and deletes are filled with tail values, so after
+     * some churn neighbouring positions are stored far apart. Once the fragmentation passes
+     * threshold the merges rewrite the value file in position order, regionSize positions per
+     * merge or everything with 0. A threshold of 0 turns it off. The merges only sample the
+     * fragmentation, FragmentationSamples pairs spread over the map.
+     */
+    void setReclustering(double threshold, IdxType regionSize = 0)
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        _reclusterThreshold = threshold;
+        _reclusterRegionSize = regionSize;
+    }
+    
+    //share of the merged positions whose value is not stored right after the one of the previous position.
+    double fragmentation()
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        return mappedFragmentation(0);
+    }
+    
+    //stores the values of the positions [from, to) at their position, concurrent gets and writes go on.
+    void recluster(IdxType from, IdxType to)
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        reclusterRegion(from, to);
+    }
+    
+    void recluster()
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        reclusterRegion(0, _positionMap.size());
+    }
+    
+    /*
+     * The active field is spilled to a run file once its estimated memory passes maxBytes, 0 turns
+     * it off. DDFieldBudget sets a budget for the fields of all indexes. The run is frozen on the
+     * thread pool, one at a time.
+     */
+    void setFieldBudget(size_t maxBytes)
+    {
+        std::unique_lock<IndexMutex> lock(_mutex);
+        _maxFieldBytes = maxBytes;
+    }
+    
+    /*
+     * Two levels of pending operations. The active field (L0) is folded into the spilled run (L1)
+     * once it holds level0Ops operations, which costs O(P log P) and leaves the core alone. The
+     * background merge into the mapped core only runs when L1 holds level1Ratio * level0Ops
+     * operations, so a merge costs O(N / P_max) per operation instead of O(N / P0). flush and
+     * finish merge every level. level0Ops 0 merges the active field directly like before.
+     */
+    void setLevels(size_t level0Ops, size_t level1Ratio)
+    {
+        _mutex.lock();
+        
+        _level0Ops = level0Ops;
+        _level1Ratio = level1Ratio;
+        
+        bool due = pendingSize() > 0 && coreMergeDue();
+        
+        _mutex.unlock();
+        
+        if (due) _mergeScheduler->notify(this);
+    }
+    
+    /*
+     * Lets the writers hand off their operations while a merge writes the core. Once handoffOps
+     * operations are pending they are sealed into a batch, up to depth batches wait behind the
+     * running merge. The batches are frozen and their deletes collected on the thread pool, so the
+     * next merge starts right with the core write. depth 0 turns it off.
+     */
+    void setPipeline(size_t depth, size_t handoffOps)
+    {
+        std::unique_lock<IndexMutex> lock(_mutex);
+        
+        _pipelineDepth = depth;
+        _handoffOps = handoffOps;
+    }
+    
+    //called by the merges of a JournaledMap once the journal is durable and before it is applied, e.g. to test the replay.
+    void setCommitHook(std::function<void ()> hook)
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        _commitHook = hook;
+    }
+    
+    //while disabled the operations pile up until flush is called, e.g. to benchmark a merge of a given size.
+    void setAutoMerge(bool autoMerge)
+    {
+        _autoMerge = autoMerge;
+        
+        if (autoMerge && pendingSize() > 0) _mergeScheduler->notify(this);
+    }
+    
+    //bytes of the mapped index and value files, without the pending operations.
+    size_t storageBytes()
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        if (!_positionMap.isOpen()) return 0;
+        
+        size_t bytes = _positionMap.fileBytes();
+        if (_yValMMapWrapper) bytes += (size_t)_yValMMapWrapper->fileSize() * sizeof(YType);
+        
+        return bytes;
+    }
+    
+    //counters and gauges of this index, see DDMetricsRegistry for the text export.
+    DDIndexMetrics::Snapshot metrics()
+    {
+        DDIndexMetrics::Snapshot snapshot = _metrics.snapshot();
+        
+        _mutex.lock();
+        
+        snapshot.gauges[DDIndexMetrics::IndexSize] = _size;
+        snapshot.gauges[DDIndexMetrics::FieldBytes] = _fieldBytes + _spillingFieldBytes + _backFieldBytes + _sealedFieldBytes;
+        snapshot.gauges[DDIndexMetrics::SealedBatches] = _sealed.size();
+        
+        //the files are gone after unpersist.
+        if (_positionMap.isOpen())
+        {
+            snapshot.gauges[DDIndexMetrics::FileGrowths] = _positionMap.fileGrowths() + (_yValMMapWrapper ? _yValMMapWrapper->fileGrowths() : 0);
+        }
+        
+        _mutex.unlock();
+        
+        snapshot.gauges[DDIndexMetrics::PendingOps] = pendingSize();
+        
+        return snapshot;
+    }
+    
+private:
+    static const IdxType DefaultMergeChunkSize = 200;
+    static const size_t LatencySampleRate = 64;
+    
+    //adjacent position pairs checked for the fragmentation after a merge.
+    static const IdxType FragmentationSamples = 4096;
+    
+    //XVal Wrapper.
+    PositionMap _positionMap;
+    
+    //YVal Wrapper.
+    MMapWrapperPtr<IdxType, YType, YValMapHeader> _yValMMapWrapper;
+    std::mutex _yValMutex;
+    
+    IdxType _size;
+    
+    IndexMutex _mutex;
+    
+    std::atomic<int> _shoutdownCount;
+    
+    DDMergeTuner<IdxType> _mergeTuner;
+    
+    DDActivePassivePtr<Field> _activPassivField;
+    
+    //mirrors of the active field size and the reads, readable without _mutex.
+    std::atomic<size_t> _activeFieldSize;
+    std::atomic<size_t> _readCount;
+    
+    DDMergeScheduler* _mergeScheduler;
+    bool _registered;
+    
+    //serializes the background merges with flush.
+    std::mutex _mergeMutex;
+    std::atomic<bool> _autoMerge;
+    
+    //guarded by _mergeMutex.
+    std::function<void ()> _commitHook;
+    double _reclusterThreshold;
+    IdxType _reclusterRegionSize;
+    IdxType _reclusterCursor;
+    
+    //first value file slot of the values staged for the active and the back field, guarded by _mutex.
+    IdxType _activeTailBase;
+    IdxType _backTailBase;
+    IdxType _backTailEnd;
+    
+    //the active fields spilled since the last merge started and the ones of the running merge.
+    //the first are read below the active field, the second below the back field. guarded by _mutex.
+    typename FrozenField::Ptr _spilled;
+    typename FrozenField::Ptr _backSpilled;
+    
+    //the active field which the thread pool freezes on top of _spilled, read in between. guarded by _mutex.
+    std::unique_ptr<Field> _spilling;
+    size_t _spillingFieldBytes;
+    
+    //0 means unlimited, guarded by _mutex like the field bytes.
+    size_t _maxFieldBytes;
+    
+    //see setLevels, guarded by _mutex.
+    size_t _level0Ops;
+    size_t _level1Ratio;
+    size_t _fieldBytes;
+    size_t _backFieldBytes;
+    DDFieldBudget* _fieldBudget;
+    
+    size_t _scopeVal;
+    size_t _idVal;
+    
+    //operations handed off while a merge writes the core. they are read between the active and
+    //the back field and merged one after the other.
+    class Batch
+    {
+    public:
+        std::unique_ptr<Field> field;
+        typename FrozenField::Ptr spilled;
+        
+        //replaces field and spilled once the batch is prepared.
+        typename FrozenField::Ptr frozen;
+        std::vector<IdxType> unmappedIdxs;
+        
+        IdxType size;
+        IdxType belowSize;
+        size_t ops;
+        size_t fieldBytes;
+        
+        //value file slots of the staged values.
+        IdxType tailBase;
+        IdxType tailEnd;
+    };
+    
+    //the oldest batch first, guarded by _mutex.
+    std::deque<std::unique_ptr<Batch>> _sealed;
+    size_t _sealedOps;
+    size_t _sealedFieldBytes;
+    
+    //notified when a batch is prepared or a spilled run is frozen.
+    std::condition_variable_any _preparedCond;
+    
+    //size of the layer below the active field, guarded by _mutex.
+    IdxType _sealSize;
+    bool _writingCore;
+    
+    //the positions of the back map below it are merged, written by the merge and read by the gets.
+    std::atomic<IdxType> _mergedWatermark;
+    
+    //odd while a merge overwrites or drops value file slots, see readValue.
+    std::atomic<size_t> _valueEpoch;
+    
+    //see setPipeline, guarded by _mutex.
+    size_t _pipelineDepth;
+    size_t _handoffOps;
+    
+    DDMergeThrottle* _mergeThrottle;
+    
+    DDIndexMetrics _metrics;
+    std::atomic<size_t> _writeCount;
+    std::string _metricsName;
+    DDMetricsRegistry* _metricsRegistry;
+    size_t _metricsId;
+    
+    static std::string metricsName(size_t scopeVal, size_t idVal)
+    {
+        std::stringstream name;
+        name << scopeVal << "_" << idVal;
+        
+        return name.str();
+    }
+    
+    static unsigned long long micros(std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+    
+    void recordLockTimes(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point locked, std::chrono::steady_clock::time_point end)
+    {
+        _metrics.add(DDIndexMetrics::LockSamples);
+        _metrics.add(DDIndexMetrics::LockWaitMicros, std::chrono::duration_cast<std::chrono::microseconds>(locked - start).count());
+        _metrics.add(DDIndexMetrics::LockHoldMicros, std::chrono::duration_cast<std::chrono::microseconds>(end - locked).count());
+        
+        DD_TRACE_COMPLETE("DDIndex", "lock wait", start, locked);
+        DD_TRACE_COMPLETE("DDIndex", "lock hold", locked, end);
+    }
+    
+    //I/O of the running merge which is not yet accounted or synced.
+    class MergeIO
+    {
+    public:
+        MergeIO() :
+            bytes(0),
+            dirtyPages(0),
+            mapSyncedIdx(0),
+            mapWrittenIdx(0),
+            valueDirtyFrom(std::numeric_limits<IdxType>::max()),
+            valueDirtyTo(0)
+        {}
+        
+        void valueWritten(IdxType slot)
+        {
+            valueDirtyFrom = std::min(valueDirtyFrom, slot);
+            valueDirtyTo = std::max(valueDirtyTo, slot + 1);
+        }
+        
+        size_t bytes;
+        size_t dirtyPages;
+        
+        //range of the back map which has been written since the last sync.
+        IdxType mapSyncedIdx;
+        IdxType mapWrittenIdx;
+        
+        //range of the value file which has been written since the last sync, empty if from >= to.
+        IdxType valueDirtyFrom;
+        IdxType valueDirtyTo;
+    };
+    
+    //called between the chunks of a merge. sleeps while the merges are over their byte budget
+    //and syncs the written pages if there are too many of them in flight.
+    void throttleMerge(MergeIO& io, size_t bytes, size_t randomPages)
+    {
+        std::chrono::microseconds wait = _mergeThrottle->acquire(bytes);
+        
+        if (wait.count() > 0)
+        {
+            _metrics.add(DDIndexMetrics::ThrottleEvents);
+            _metrics.add(DDIndexMetrics::ThrottleMicros, wait.count());
+            
+            DD_TRACE_COMPLETE("DDIndex", "throttle", std::chrono::steady_clock::now() - wait, std::chrono::steady_clock::now());
+        }
+        
+        static const size_t pageSize = sysconf(_SC_PAGESIZE);
+        
+        io.bytes += bytes;
+        size_t pages = io.bytes / pageSize + randomPages;
+        io.bytes %= pageSize;
+        
+        io.dirtyPages += pages;
+        
+        if (_mergeThrottle->addDirtyPages(pages))
+        {
+            syncBack(io.mapSyncedIdx, io.mapWrittenIdx, JournaledMap());
+            io.mapSyncedIdx = io.mapWrittenIdx;
+            
+            //only the merge changes the mapping of the value file.
+            if (_yValMMapWrapper && io.valueDirtyFrom < io.valueDirtyTo)
+            {
+                _yValMMapWrapper->sync(io.valueDirtyFrom, io.valueDirtyTo);
+            }
+            
+            io.valueDirtyFrom = std::numeric_limits<IdxType>::max();
+            io.valueDirtyTo = 0;
+            
+            _mergeThrottle->removeDirtyPages(io.dirtyPages);
+            io.dirtyPages = 0;
+        }
+    }
+    
+    static DDIndex& finished(DDIndex& index)
+    {
+        index.finish();
+        return index;
+    }
+    
+    void registerIndex()
+    {
+        _mergeScheduler->add(this);
+        _metricsId = _metricsRegistry->add(_metricsName, [this]() { return metrics(); });
+        _registered = true;
+        
+        //persisted operations can not be pending, but a moved index can have some.
+        if (pendingSize() > 0) _mergeScheduler->notify(this);
+    }
+    
+    //
+    //DDMergeScheduler::Client
+    size_t pendingSize()
+    {
+        return _activeFieldSize.load(std::memory_order_relaxed);
+    }
+    
+    size_t readCount()
+    {
+        return _readCount.load(std::memory_order_relaxed);
+    }
+    
+    void merge()
+    {
+        std::unique_lock<std::mutex> lock(_mergeMutex);
+        
+        _mutex.lock();
+        bool due = coreMergeDue();
+        _mutex.unlock();
+        
+        if (_autoMerge && pendingSize() > 0 && due)
+        {
+            mapFuncts();
+            reclusterIfFragmented();
+            
+            //a merge of a handed off batch leaves the active field as it is, no write sees it empty.
+            _mutex.lock();
+            bool again = pendingSize() > 0 && coreMergeDue();
+            _mutex.unlock();
+            
+            if (again) _mergeScheduler->notify(this);
+        }
+        
+        _readCount.store(0, std::memory_order_relaxed);
+    }
+    
+    static MMapWrapperPtr<IdxType, YType, YValMapHeader> valueMap(size_t scopeVal, size_t idVal, std::false_type)
+    {
+        return DDMMapAllocator<IdxType>::SHARED()->template getHandleFromDataStore<YType, YValMapHeader>(scopeVal, idVal);
+    }
+    
+    //the values live in the position map, there is no value file.
+    static MMapWrapperPtr<IdxType, YType, YValMapHeader> valueMap(size_t, size_t, std::true_type)
+    {
+        return MMapWrapperPtr<IdxType, YType, YValMapHeader>();
+    }
+    
+    /*
+     * Called with _mutex held. Resolves idx through the fields and the maps, returns false with the
+     * value in yVal or true with the slot of the value file which holds it.
+     */
+    bool resolve(IdxType idx, YType& yVal, IdxType& slot, DDIndexMetrics::Counter& source)
+    {
+        source = DDIndexMetrics::GetsFromActiveField;
+        
+        bool hasCacheElement;
+        FieldElement element;
+        idx = _activPassivField->eval(idx, hasCacheElement, element);
+        
+        if (!hasCacheElement && _spilling)
+        {
+            source = DDIndexMetrics::GetsFromSpill;
+            idx = _spilling->eval(idx, hasCacheElement, element);
+        }
+        
+        if (!hasCacheElement && _spilled)
+        {
+            source = DDIndexMetrics::GetsFromSpill;
+            idx = _spilled->eval(idx, hasCacheElement, element);
+        }
+        
+        IdxType tailBase;
+        
+        if (hasCacheElement)
+        {
+            return fieldSlot(element, _activeTailBase, yVal, slot, StagedValues());
+        }
+        
+        if (evalSealed(idx, hasCacheElement, element, tailBase, source))
+        {
+            return fieldSlot(element, tailBase, yVal, slot, StagedValues());
+        }
+        
+        if (PositionMap::ConcurrentBackReads && idx < _mergedWatermark.load(std::memory_order_acquire))
+        {
+            source = DDIndexMetrics::GetsBelowWatermark;
+            return mergedSlot(idx, yVal, slot, DirectValues());
+        }
+        
+        source = DDIndexMetrics::GetsFromBackField;
+        idx = _activPassivField.back().eval(idx, hasCacheElement, element);
+        
+        if (!hasCacheElement && _backSpilled)
+        {
+            source = DDIndexMetrics::GetsFromSpill;
+            idx = _backSpilled->eval(idx, hasCacheElement, element);
+        }
+        
+        if (hasCacheElement)
+        {
+            return fieldSlot(element, _backTailBase, yVal, slot, StagedValues());
+        }
+        
+        source = DDIndexMetrics::GetsFromMMap;
+        return mappedSlot(idx, yVal, slot, DirectValues());
+    }
+    
+    /*
+     * Reads a slot which has been resolved under _mutex without holding it, the pin keeps the value
+     * file mapped. Merges which overwrite or drop slots make _valueEpoch odd while they do, a read
+     * which overlaps one fails and is repeated under the lock.
+     */
+    bool readValue(IdxType slot, size_t epoch, YType& yVal)
+    {
+        if (epoch % 2 != 0) return false;
+        
+        typename MMapWrapper<IdxType, YType, YValMapHeader>::ReadPin pin(*_yValMMapWrapper);
+        
+        //the file may have shrunk before the pin.
+        if (_valueEpoch.load(std::memory_order_acquire) != epoch) return false;
+        
+        yVal = _yValMMapWrapper->getPinnedVal(slot);
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        
+        return _valueEpoch.load(std::memory_order_relaxed) == epoch;
+    }
+    
+    //called with _mergeMutex held around writes which overwrite or drop value file slots.
+    void beginValueMoves()
+    {
+        _valueEpoch.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    
+    void endValueMoves()
+    {
+        _valueEpoch.fetch_add(1, std::memory_order_release);
+    }
+    
+    //get and size take _mutex shared with SharedReads, resolve only reads the fields and the maps.
+    void lockShared(std::true_type)
+    {
+        _mutex.lock_shared();
+    }
+    
+    void lockShared(std::false_type)
+    {
+        _mutex.lock();
+    }
+    
+    void unlockShared(std::true_type)
+    {
+        _mutex.unlock_shared();
+    }
+    
+    void unlockShared(std::false_type)
+    {
+        _mutex.unlock();
+    }
+    
+    //called with _mutex held.
+    bool mappedSlot(IdxType idx, YType&, IdxType& slot, std::false_type)
+    {
+        slot = _positionMap.get(idx);
+        return true;
+    }
+    
+    bool mappedSlot(IdxType idx, YType& yVal, IdxType&, std::true_type)
+    {
+        yVal = _positionMap.get(idx);
+        return false;
+    }
+    
+    /*
+     * Called with _mutex held for a position below the merged watermark, without _yValMutex. The gap
+     * close changes the back map after it has copied the value and the old slot keeps it until the
+     * switch, so either slot holds it. The gap close makes _valueEpoch odd, a get which overlaps it
+     * reads again under _yValMutex.
+     */
+    bool mergedSlot(IdxType idx, YType&, IdxType& slot, std::false_type)
+    {
+        slot = _positionMap.getBack(idx);
+        return true;
+    }
+    
+    bool mergedSlot(IdxType idx, YType& yVal, IdxType&, std::true_type)
+    {
+        yVal = _positionMap.getBack(idx);
+        return false;
+    }
+    
+    //called with _mutex held.
+    FieldElement stage(const YType& yValue, std::false_type)
+    {
+        return yValue;
+    }
+    
+    //appends the value, _yValMutex keeps the merge from reading the file while it grows. the slots of
+    //deleted and overwritten staged values are not reused, the next merge closes them as gaps and
+    //truncates the file. setLevels or setFieldBudget bound the growth in between.
+    FieldElement stage(const YType& yValue, std::true_type)
+    {
+        std::unique_lock<std::mutex> lock(_yValMutex);
+        
+        IdxType slot = _yValMMapWrapper->size();
+        _yValMMapWrapper->persistVal(slot, yValue);
+        
+        return slot - _activeTailBase;
+    }
+    
+    //called with _mutex held.
+    bool fieldSlot(const FieldElement& element, IdxType, YType& yVal, IdxType&, std::false_type)
+    {
+        yVal = element;
+        return false;
+    }
+    
+    bool fieldSlot(const FieldElement& element, IdxType tailBase, YType&, IdxType& slot, std::true_type)
+    {
+        slot = tailBase + element;
+        return true;
+    }
+    
+    //called with _mutex held after a write, returns whether the merge scheduler has to be notified.
+    bool accountField(bool wasEmpty)
+    {
+        size_t bytes = _activPassivField->memoryBytes();
+        
+        _fieldBudget->update(_fieldBytes, bytes);
+        _fieldBytes = bytes;
+        
+        bool folded = false;
+        
+        if (!_spilling && ((_maxFieldBytes > 0 && bytes > _maxFieldBytes) || _fieldBudget->shouldSpill(bytes) ||
+            (_level0Ops > 0 && _activPassivField->size() >= _level0Ops)))
+        {
+            spill();
+            folded = true;
+        }
+        
+        size_t pending = _activPassivField->size() + spilledOps();
+        
+        //the batch takes _spilled along, so not while it is frozen on.
+        if (_writingCore && !_spilling && _sealed.size() < _pipelineDepth && pending > 0 && pending >= _handoffOps)
+        {
+            handoff();
+            updatePendingSize();
+            
+            return true;
+        }
+        
+        updatePendingSize();
+        
+        if (_level0Ops == 0) return wasEmpty;
+        
+        return folded && coreMergeDue();
+    }
+    
+    //called with _mutex held.
+    void updatePendingSize()
+    {
+        _activeFieldSize.store(_activPassivField->size() + spilledOps() + _sealedOps, std::memory_order_relaxed);
+    }
+    
+    //called with _mutex held, the operations below the active field which are not handed off.
+    size_t spilledOps()
+    {
+        return (_spilling ? _spilling->size() : 0) + (_spilled ? _spilled->ops() : 0);
+    }
+    
+    //called with _mutex held. without levels every pending operation is due, so are handed off batches.
+    bool coreMergeDue()
+    {
+        if (_level0Ops == 0 || !_sealed.empty()) return true;
+        
+        return spilledOps() >= _level0Ops * _level1Ratio;
+    }
+    
+    /*
+     * Called with _mutex held. The active field moves aside in O(1) and the thread pool freezes it
+     * into a run file together with the runs spilled before, so its memory is freed without a
+     * merge. The freeze costs O(P log P) for the P spilled operations, the gets and writes go on.
+     */
+    void spill()
+    {
+        Field field;
+        field.setWindowWidth(_activPassivField->windowWidth());
+        
+        _spilling.reset(new Field(std::move(*_activPassivField)));
+        *_activPassivField = std::move(field);
+        
+        _spillingFieldBytes = _fieldBytes;
+        _fieldBytes = 0;
+        
+        IdxType size = _size;
+        size_t ops = spilledOps();
+        
+        DDThreadPool::SHARED()->submit([this, size, ops]() { freezeSpill(size, ops); });
+    }
+    
+    //_spilling and _spilled do not change until the frozen run replaces them.
+    void freezeSpill(IdxType size, size_t ops)
+    {
+        DD_TRACE_SPAN("DDIndex", "spill");
+        
+        auto spillStart = std::chrono::steady_clock::now();
+        
+        typename FrozenField::Ptr frozen = FrozenField::freeze(*_spilling, size, _spilled.get(), ops, FrozenField::runPath(_scopeVal, _idVal));
+        
+        std::unique_lock<IndexMutex> lock(_mutex);
+        
+        _spilled = std::move(frozen);
+        _spilling.reset();
+        
+        _fieldBudget->update(_spillingFieldBytes, 0);
+        _spillingFieldBytes = 0;
+        
+        _metrics.add(DDIndexMetrics::Spills);
+        _metrics.add(DDIndexMetrics::SpillMicros, micros(std::chrono::steady_clock::now() - spillStart));
+        
+        _preparedCond.notify_all();
+    }
+    
+    /*
+     * Called with _mutex held while a merge writes the core. The pending operations move into a
+     * new batch in O(1), the thread pool prepares it.
+     */
+    void handoff()
+    {
+        std::unique_ptr<Batch> batch(new Batch());
+        
+        Field field;
+        field.setWindowWidth(_activPassivField->windowWidth());
+        
+        batch->field.reset(new Field(std::move(*_activPassivField)));
+        *_activPassivField = std::move(field);
+        
+        batch->spilled = std::move(_spilled);
+        batch->size = _size;
+        batch->belowSize = _sealSize;
+        batch->ops = batch->field->size() + (batch->spilled ? batch->spilled->ops() : 0);
+        batch->fieldBytes = _fieldBytes;
+        batch->tailBase = _activeTailBase;
+        batch->tailEnd = _activeTailBase;
+        
+        if (_yValMMapWrapper)
+        {
+            std::unique_lock<std::mutex> lock(_yValMutex);
+            batch->tailEnd = _yValMMapWrapper->size();
+        }
+        
+        _activeTailBase = batch->tailEnd;
+        _sealSize = _size;
+        
+        _sealedOps += batch->ops;
+        _sealedFieldBytes += _fieldBytes;
+        _fieldBytes = 0;
+        
+        Batch* prepared = batch.get();
+        _sealed.push_back(std::move(batch));
+        
+        _metrics.add(DDIndexMetrics::Handoffs);
+        
+        DDThreadPool::SHARED()->submit([this, prepared]() { prepare(*prepared); });
+    }
+    
+    //runs on the thread pool. the batch does not change until it is published, the gets read it meanwhile.
+    void prepare(Batch& batch)
+    {
+        DD_TRACE_SPAN("DDIndex", "prepare");
+        
+        typename FrozenField::Ptr frozen = FrozenField::freeze(*batch.field, batch.size, batch.spilled.get(), batch.ops, FrozenField::runPath(_scopeVal, _idVal));
+        std::vector<IdxType> unmappedIdxs = unmappedSlots(*frozen, batch.belowSize, DirectValues());
+        
+        std::unique_lock<IndexMutex> lock(_mutex);
+        
+        batch.frozen = std::move(frozen);
+        batch.unmappedIdxs.swap(unmappedIdxs);
+        batch.field.reset();
+        batch.spilled.reset();
+        
+        _fieldBudget->update(batch.fieldBytes, 0);
+        _sealedFieldBytes -= batch.fieldBytes;
+        batch.fieldBytes = 0;
+        
+        _preparedCond.notify_all();
+    }
+    
+    //called with _mutex held, the newest batch first.
+    bool evalSealed(IdxType& idx, bool& hasCacheElement, FieldElement& element, IdxType& tailBase, DDIndexMetrics::Counter& source)
+    {
+        for (auto itr = _sealed.rbegin(); itr != _sealed.rend(); itr++)
+        {
+            Batch& batch = **itr;
+            
+            source = DDIndexMetrics::GetsFromSpill;
+            
+            if (batch.frozen)
+            {
+                idx = batch.frozen->eval(idx, hasCacheElement, element);
+            }
+            else
+            {
+                idx = batch.field->eval(idx, hasCacheElement, element);
+                
+                if (!hasCacheElement && batch.spilled) idx = batch.spilled->eval(idx, hasCacheElement, element);
+            }
+            
+            if (hasCacheElement)
+            {
+                tailBase = batch.tailBase;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    //called with _mergeMutex held. checks samples pairs spread over the map, 0 checks every pair.
+    double mappedFragmentation(IdxType samples)
+    {
+        return mappedFragmentation(samples, DirectValues());
+    }
+    
+    //the values are stored in position order.
+    double mappedFragmentation(IdxType, std::true_type)
+    {
+        return 0;
+    }
+    
+    double mappedFragmentation(IdxType samples, std::false_type)
+    {
+        IdxType mappedSize = _positionMap.size();
+        
+        if (!_yValMMapWrapper || !_positionMap.isMapped() || mappedSize < 2) return 0;
+        
+        IdxType pairs = mappedSize - 1;
+        if (samples == 0 || samples > pairs) samples = pairs;
+        
+        IdxType breaks = 0;
+        
+        for (IdxType i = 0; i < samples; i++)
+        {
+            IdxType idx = (IdxType)((unsigned long long)i * pairs / samples);
+            
+            if (_positionMap.get(idx + 1) != _positionMap.get(idx) + 1) breaks++;
+        }
+        
+        return (double)breaks / (double)samples;
+    }
+    
+    //called with _mergeMutex held after a merge.
+    void reclusterIfFragmented()
+    {
+        if (_reclusterThreshold <= 0) return;
+        
+        double fragmentation = mappedFragmentation(FragmentationSamples);
+        _metrics.set(DDIndexMetrics::FragmentationPermille, (unsigned long long)(fragmentation * 1000));
+        
+        if (fragmentation < _reclusterThreshold) return;
+        
+        IdxType mappedSize = _positionMap.size();
+        
+        if (_reclusterRegionSize == 0 || _reclusterRegionSize >= mappedSize)
+        {
+            reclusterRegion(0, mappedSize);
+            return;
+        }
+        
+        if (_reclusterCursor >= mappedSize) _reclusterCursor = 0;
+        
+        IdxType to = mappedSize - _reclusterCursor > _reclusterRegionSize ? _reclusterCursor + _reclusterRegionSize : mappedSize;
+        
+        reclusterRegion(_reclusterCursor, to);
+        _reclusterCursor = to;
+    }
+    
+    /*
+     * Called with _mergeMutex held, so the maps and the value file only change here. Position idx
+     * swaps its value with the one stored in slot idx, the swaps run in chunks under _mutex and
+     * _yValMutex so the gets see either side of a swap.
+     */
+    void reclusterRegion(IdxType from, IdxType to)
+    {
+        reclusterRegion(from, to, DirectValues());
+    }
+    
+    void reclusterRegion(IdxType, IdxType, std::true_type)
+    {
+    }
+    
+    void reclusterRegion(IdxType from, IdxType to, std::false_type)
+    {
+        DD_TRACE_SPAN("DDIndex", "recluster");
+        
+        IdxType mappedSize = _positionMap.size();
+        
+        if (!_yValMMapWrapper || !_positionMap.isMapped()) return;
+        
+        if (to > mappedSize) to = mappedSize;
+        if (from >= to) return;
+        
+        auto reclusterStart = std::chrono::steady_clock::now();
+        
+        //position of the value in each slot of the region, slots behind it are not read again.
+        std::vector<IdxType> positions(to - from);
+        
+        for (IdxType idx = 0; idx < mappedSize; idx++)
+        {
+            IdxType slot = _positionMap.get(idx);
+            
+            if (slot >= from && slot < to) positions[slot - from] = idx;
+        }
+        
+        IdxType range = _mergeTuner.mergeChunkSize();
+        
+        MergeIO mergeIO;
+        size_t moves = 0;
+        
+        IdxType chunkEnd;
+        
+        for (IdxType chunkIdx = from; chunkIdx < to; chunkIdx = chunkEnd)
+        {
+            chunkEnd = to - chunkIdx > range ? chunkIdx + range : to;
+            size_t chunkMoves = 0;
+            
+            {
+                std::unique_lock<IndexMutex> lock(_mutex);
+                std::unique_lock<std::mutex> yValLock(_yValMutex);
                 
-                IdxType mappedFieldidx = backField.insertFieldEval(ret, hasCacheElement, yObj);
+                beginValueMoves();
                 
-                if (!hasCacheElement)
+                for (IdxType idx = chunkIdx; idx < chunkEnd; idx++)
                 {
-                    IdxType mappedIdx = _doubleSyncedMMapWrapper.get(mappedFieldidx);
+                    IdxType slot = _positionMap.get(idx);
                     
-                    //remap idxs which are too big.
-                    if (mappedIdx >= indexSize)
-                    {
-                        remapIdxs.push_back(idx);
-                    }
+                    if (slot == idx) continue;
                     
-                    _doubleSyncedMMapWrapper.persist(idx, mappedIdx);
-                }
-                else
-                {
-                    IdxType nextIdx;
+                    //the value in slot idx belongs to position other and moves to slot.
+                    IdxType other = positions[idx - from];
+                    YType yObj = _yValMMapWrapper->getVal(idx);
                     
-                    std::unique_lock<std::mutex> lock(_yValMutex);
+                    _yValMMapWrapper->persistVal(idx, _yValMMapWrapper->getVal(slot));
+                    _yValMMapWrapper->persistVal(slot, yObj);
                     
-                    nextIdx = _yValMMapWrapper->size();
-                    _yValMMapWrapper->persistVal(nextIdx, yObj);
-                     
-                    if (nextIdx >= indexSize)
-                    {
-                        remapIdxs.push_back(idx);
-                    }
+                    _positionMap.persistActive(idx, idx);
+                    _positionMap.persistActive(other, slot);
                     
-                    _doubleSyncedMMapWrapper.persist(idx, nextIdx);
+                    mergeIO.valueWritten(idx);
+                    mergeIO.valueWritten(slot);
+                    
+                    if (slot > idx && slot < to) positions[slot - from] = other;
+                    
+                    chunkMoves++;
                 }
+                
+                endValueMoves();
             }
-        };
+            
+            moves += chunkMoves;
+            throttleMerge(mergeIO, chunkMoves * 2 * (sizeof(IdxType) + sizeof(YType)), 2 * chunkMoves);
+        }
         
-        rangeLoop(range, indexSize, reduceMapOntoDoubleSyncedMMapWrapper);
+        _mergeThrottle->removeDirtyPages(mergeIO.dirtyPages);
+        
+        _metrics.add(DDIndexMetrics::Reclusters);
+        _metrics.add(DDIndexMetrics::ReclusterMoves, moves);
+        _metrics.add(DDIndexMetrics::ReclusterMicros, micros(std::chrono::steady_clock::now() - reclusterStart));
+    }
+    //
+    //
+    
+    //the rewrite of one position, returns the number of values appended to the value file.
+    size_t rewriteIdx(IdxType idx, IdxType mappedFieldidx, bool hasCacheElement, const FieldElement& yObj, IdxType indexSize, std::vector<IdxType>& remapIdxs, MergeIO& mergeIO, std::false_type)
+    {
+        if (!hasCacheElement)
+        {
+            IdxType mappedIdx = _positionMap.get(mappedFieldidx);
+            
+            //remap idxs which are too big.
+            if (mappedIdx >= indexSize)
+            {
+                remapIdxs.push_back(idx);
+            }
+            
+            _positionMap.persist(idx, mappedIdx);
+        }
+        else
+        {
+            size_t valueWrites = 0;
+            IdxType nextIdx = backSlot(yObj, valueWrites, mergeIO, StagedValues());
+             
+            if (nextIdx >= indexSize)
+            {
+                remapIdxs.push_back(idx);
+            }
+            
+            _positionMap.persist(idx, nextIdx);
+            
+            return valueWrites;
+        }
+        
+        return 0;
+    }
+    
+    //the value file slot of a cached element of the back field, values which are not staged are appended.
+    IdxType backSlot(const FieldElement& yObj, size_t& valueWrites, MergeIO& mergeIO, std::false_type)
+    {
+        std::unique_lock<std::mutex> lock(_yValMutex);
+        
+        IdxType nextIdx = _yValMMapWrapper->size();
+        _yValMMapWrapper->persistVal(nextIdx, yObj);
         
+        valueWrites++;
+        mergeIO.valueWritten(nextIdx);
+        
+        return nextIdx;
+    }
+    
+    IdxType backSlot(const FieldElement& yObj, size_t&, MergeIO&, std::true_type)
+    {
+        return _backTailBase + yObj;
+    }
+    
+    size_t rewriteIdx(IdxType idx, IdxType mappedFieldidx, bool hasCacheElement, const FieldElement& yObj, IdxType, std::vector<IdxType>&, MergeIO&, std::true_type)
+    {
+        //the value travels with its position, there are no slots to remap.
+        if (!hasCacheElement)
+        {
+            _positionMap.persist(idx, _positionMap.get(mappedFieldidx));
+        }
+        else
+        {
+            _positionMap.persist(idx, yObj);
+        }
         
+        return 0;
+    }
+    
+    //the value file slots freed by the deletes of the back field.
+    std::vector<IdxType> collectDeletedSlots(Field& backField, IdxType indexSize, std::false_type)
+    {
+        std::vector<IdxType> deletedIdxs2;
         
         backField.startItr();
         
@@ -585,21 +2148,104 @@ private:
         for (auto itr = delIdxs.begin(); itr<delIdxs.end(); itr++)
         {
             bool hasCacheElement;
-            YType yObj;
+            FieldElement yObj;
             
             IdxType idx = backField.insertFieldEval(*itr, hasCacheElement, yObj);
             
             if (!hasCacheElement)
             {
-                IdxType mappedIdx = _doubleSyncedMMapWrapper.get(idx);
+                IdxType mappedIdx = _positionMap.get(idx);
                 
                 if (mappedIdx < indexSize)
                 {
                     deletedIdxs2.push_back(mappedIdx);
                 }
             }
+            else
+            {
+                collectStagedSlot(yObj, indexSize, deletedIdxs2, StagedValues());
+            }
+        }
+        
+        return deletedIdxs2;
+    }
+    
+    void collectStagedSlot(const FieldElement&, IdxType, std::vector<IdxType>&, std::false_type)
+    {
+    }
+    
+    //a value which has been staged and deleted before the merge leaves a gap.
+    void collectStagedSlot(const FieldElement& yObj, IdxType indexSize, std::vector<IdxType>& deletedIdxs2, std::true_type)
+    {
+        if (_backTailBase + yObj < indexSize)
+        {
+            deletedIdxs2.push_back(_backTailBase + yObj);
+        }
+    }
+    
+    //the positions of the map which the merged field does not reference are deleted.
+    static std::vector<IdxType> unmappedSlots(const FrozenField& merged, IdxType mappedSize, std::false_type)
+    {
+        return merged.unmappedIdxs(mappedSize);
+    }
+    
+    static std::vector<IdxType> unmappedSlots(const FrozenField&, IdxType, std::true_type)
+    {
+        return std::vector<IdxType>();
+    }
+    
+    std::vector<IdxType> collectDeletedSlots(const FrozenField& merged, const std::vector<IdxType>& delIdxs, IdxType indexSize, std::false_type)
+    {
+        std::vector<IdxType> deletedIdxs2;
+        
+        for (auto itr = delIdxs.begin(); itr<delIdxs.end(); itr++)
+        {
+            IdxType mappedIdx = _positionMap.get(*itr);
+            
+            if (mappedIdx < indexSize)
+            {
+                deletedIdxs2.push_back(mappedIdx);
+            }
         }
         
+        collectStagedSlots(merged, indexSize, deletedIdxs2, StagedValues());
+        
+        return deletedIdxs2;
+    }
+    
+    std::vector<IdxType> collectDeletedSlots(const FrozenField&, const std::vector<IdxType>&, IdxType, std::true_type)
+    {
+        return std::vector<IdxType>();
+    }
+    
+    void collectStagedSlots(const FrozenField&, IdxType, std::vector<IdxType>&, std::false_type)
+    {
+    }
+    
+    //the staged values of the back field which the merged field does not reference leave gaps.
+    void collectStagedSlots(const FrozenField& merged, IdxType indexSize, std::vector<IdxType>& deletedIdxs2, std::true_type)
+    {
+        std::vector<bool> referenced(_backTailEnd - _backTailBase, false);
+        
+        for (size_t i = 0; i < merged.cachedElements(); i++)
+        {
+            referenced[merged.cachedElement(i)] = true;
+        }
+        
+        for (IdxType i = 0; i < referenced.size() && _backTailBase + i < indexSize; i++)
+        {
+            if (!referenced[i]) deletedIdxs2.push_back(_backTailBase + i);
+        }
+    }
+    
+    std::vector<IdxType> collectDeletedSlots(Field&, IdxType, std::true_type)
+    {
+        return std::vector<IdxType>();
+    }
+    
+    //moves the values of the remapped and the tail positions into the deleted slots.
+    void closeGaps(const std::vector<IdxType>& deletedIdxs2, const std::vector<IdxType>& remapIdxs, IdxType indexSize, IdxType range, MergeIO& mergeIO, std::false_type)
+    {
         //close gaps in YVal Map.
         IdxType idx;
         IdxType mvidx;
@@ -613,8 +2259,22 @@ private:
         
         assert(deletedIdxs2.size() >= remapIdxs.size());
         
+        //the gaps are closed at random positions of both maps.
+        mergeIO.mapSyncedIdx = 0;
+        mergeIO.mapWrittenIdx = indexSize;
+        
+        //the deleted slots can still be read by gets which resolved them before the merge.
+        beginValueMoves();
+        
         for (IdxType i = 0; i< deletedIdxs2.size() > 0; i++)
         {
+            if (i > 0 && i % range == 0)
+            {
+                endValueMoves();
+                throttleMerge(mergeIO, range * (sizeof(IdxType) + sizeof(YType)), 2 * range);
+                beginValueMoves();
+            }
+            
             std::unique_lock<std::mutex> lock(_yValMutex);
             
             if (remapIdxs.size() > remapIdx)
@@ -629,32 +2289,320 @@ private:
             }
             
             
-            mvidx = _doubleSyncedMMapWrapper.getBack(idx);
+            mvidx = _positionMap.getBack(idx);
             
             yObj = _yValMMapWrapper->getVal(mvidx);
             
             delIdx = deletedIdxs2[i];
             
             _yValMMapWrapper->persistVal(delIdx, yObj);
-            _doubleSyncedMMapWrapper.persist(idx, delIdx);
+            _positionMap.persist(idx, delIdx);
+            
+            mergeIO.valueWritten(delIdx);
+        }
+        
+        endValueMoves();
+    }
+    
+    void closeGaps(const std::vector<IdxType>&, const std::vector<IdxType>&, IdxType, IdxType, MergeIO&, std::true_type)
+    {
+    }
+    
+    //called with _mutex and _yValMutex held at the end of a merge.
+    void truncateValues(IdxType indexSize, std::false_type)
+    {
+        beginValueMoves();
+        _yValMMapWrapper->resize(indexSize);
+        endValueMoves();
+    }
+    
+    //the values staged after the merged ones move down behind them, with the batches which own them.
+    void truncateValues(IdxType indexSize, std::true_type)
+    {
+        IdxType staged = _yValMMapWrapper->size() - _backTailEnd;
+        
+        beginValueMoves();
+        
+        for (IdxType i = 0; i < staged; i++)
+        {
+            _yValMMapWrapper->persistVal(indexSize + i, _yValMMapWrapper->getVal(_backTailEnd + i));
+        }
+        
+        IdxType shift = _backTailEnd - indexSize;
+        
+        for (auto itr = _sealed.begin(); itr != _sealed.end(); itr++)
+        {
+            (*itr)->tailBase -= shift;
+            (*itr)->tailEnd -= shift;
+        }
+        
+        _activeTailBase -= shift;
+        _yValMMapWrapper->resize(indexSize + staged);
+        
+        endValueMoves();
+    }
+    
+    //the double synced back map is synced by the merge throttle, the journal in one go by commitBack.
+    void syncBack(IdxType fromIdx, IdxType toIdx, std::false_type)
+    {
+        _positionMap.syncBack(fromIdx, toIdx);
+    }
+    
+    void syncBack(IdxType, IdxType, std::true_type)
+    {
+    }
+    
+    void commitBack(std::false_type)
+    {
+    }
+    
+    void commitBack(std::true_type)
+    {
+        _positionMap.commitBack();
+        
+        if (_commitHook) _commitHook();
+    }
+    
+    void applyBack(std::false_type)
+    {
+    }
+    
+    void applyBack(std::true_type)
+    {
+        _positionMap.applyBack(_mutex);
+    }
+    
+    void mapFuncts()
+    {
+        DD_TRACE_SPAN("DDIndex", "merge");
+        
+        IdxType indexSize;
+        
+        auto mergeStart = std::chrono::steady_clock::now();
+        
+        _mutex.lock();
+        
+        auto locked = std::chrono::steady_clock::now();
+        
+        Field& backField = _activPassivField.back();
+        
+        size_t mergingOps;
+        
+        //a handed off batch has its deletes collected already.
+        bool prepared = !_sealed.empty();
+        std::vector<IdxType> unmappedIdxs;
+        
+        if (prepared)
+        {
+            //the oldest batch is merged first, the newer ones and the active field stay on top.
+            std::unique_lock<IndexMutex> lock(_mutex, std::adopt_lock);
+            _preparedCond.wait(lock, [this]() { return (bool)_sealed.front()->frozen; });
+            lock.release();
+            
+            std::unique_ptr<Batch> batch = std::move(_sealed.front());
+            _sealed.pop_front();
+            
+            assert(batch->belowSize == _positionMap.size());
+            
+            _backSpilled = std::move(batch->frozen);
+            unmappedIdxs.swap(batch->unmappedIdxs);
+            
+            _backTailBase = batch->tailBase;
+            _backTailEnd = batch->tailEnd;
+            _sealedOps -= batch->ops;
+            
+            indexSize = batch->size;
+            mergingOps = batch->ops;
+        }
+        else
+        {
+            //a spilled run which is still frozen is merged with the others.
+            std::unique_lock<IndexMutex> lock(_mutex, std::adopt_lock);
+            _preparedCond.wait(lock, [this]() { return !_spilling; });
+            lock.release();
+            
+            _activPassivField.swap();
+            
+            //the staged values of the back field end where the new ones start.
+            _backTailBase = _activeTailBase;
+            if (_yValMMapWrapper) _activeTailBase = _yValMMapWrapper->size();
+            _backTailEnd = _activeTailBase;
+            
+            _backSpilled = std::move(_spilled);
+            _backFieldBytes = _fieldBytes;
+            _fieldBytes = 0;
+            
+            indexSize = _size;
+            _sealSize = indexSize;
+            
+            mergingOps = backField.size() + (_backSpilled ? _backSpilled->ops() : 0);
+        }
+        
+        _writingCore = true;
+        updatePendingSize();
+        
+        _mutex.unlock();
+        
+        recordLockTimes(mergeStart, locked, std::chrono::steady_clock::now());
+        
+        _metrics.set(DDIndexMetrics::MergingOps, mergingOps);
+        
+        //the walk stats have been collected while the back field was the active field.
+        if (!prepared) _mergeTuner.observeField(backField.walkStats());
+        
+        IdxType range = _mergeTuner.mergeChunkSize();
+        
+        auto rangeLoop = [] (IdxType range, IdxType size, std::function<void (IdxType idx, IdxType range)> closure)
+        {
+            IdxType currIdx = 0;
+            bool done = false;
+            while (true)
+            {
+                if (currIdx + range >= size)
+                {
+                    done = true;
+                    range = size - currIdx;
+                }
+                
+                closure(currIdx, range);
+                
+                //exit
+                if (done) break;
+                
+                currIdx += range;
+            }
+        };
+        
+        
+        backField.startItr();
+        std::vector<IdxType> remapIdxs;
+        
+        //with spilled runs the back field and the runs are merged as one frozen field.
+        typename FrozenField::Ptr backFrozen;
+        const FrozenField* merged = 0;
+        std::unique_ptr<typename FrozenField::Cursor> backCursor;
+        
+        if (prepared)
+        {
+            merged = _backSpilled.get();
+        }
+        else if (_backSpilled)
+        {
+            backFrozen = FrozenField::freeze(backField, indexSize, _backSpilled.get(), mergingOps, FrozenField::runPath(_scopeVal, _idVal));
+            merged = backFrozen.get();
         }
         
+        if (merged) backCursor.reset(new typename FrozenField::Cursor(*merged));
+        
+        MergeIO mergeIO;
+        size_t mergeBytes = 0;
+        
+        auto reduceMapOntoDoubleSyncedMMapWrapper = [this, &backField, &backCursor, &indexSize, &remapIdxs, &mergeIO, &mergeBytes] (IdxType idxIN, IdxType range)
+        {
+            DD_TRACE_SPAN("DDIndex", "rewrite chunk");
+            
+            bool hasCacheElement;
+            FieldElement yObj;
+            
+            size_t valueWrites = 0;
+            
+            for (IdxType i = 0; i < range; i++)
+            {
+                IdxType idx = i + idxIN;
+                
+                IdxType mappedFieldidx = backCursor ? backCursor->itrEvalAndStep(hasCacheElement, yObj) : backField.itrEvalAndStep(hasCacheElement, yObj);
+                
+                valueWrites += rewriteIdx(idx, mappedFieldidx, hasCacheElement, yObj, indexSize, remapIdxs, mergeIO, DirectValues());
+            }
+            
+            mergeIO.mapWrittenIdx = idxIN + range;
+            
+            //the gets read the finished positions from the back map.
+            _mergedWatermark.store(idxIN + range, std::memory_order_release);
+            mergeBytes += range * sizeof(MapType) + valueWrites * sizeof(YType);
+            throttleMerge(mergeIO, range * sizeof(MapType) + valueWrites * sizeof(YType), 0);
+        };
+        
+        //sized up front, the back map must not be remapped while the gets read below the watermark.
+        _positionMap.resize(indexSize);
+        
+        auto rewriteStart = std::chrono::steady_clock::now();
+        
+        rangeLoop(range, indexSize, reduceMapOntoDoubleSyncedMMapWrapper);
+        
+        auto deleteCollectStart = std::chrono::steady_clock::now();
+        
+        _mergeTuner.observeMerge(indexSize, std::chrono::duration_cast<std::chrono::microseconds>(deleteCollectStart - rewriteStart));
+        
+        
+        
+        if (merged && !prepared) unmappedIdxs = unmappedSlots(*merged, _positionMap.size(), DirectValues());
+        
+        std::vector<IdxType> deletedIdxs2 = merged ? collectDeletedSlots(*merged, unmappedIdxs, indexSize, DirectValues()) : collectDeletedSlots(backField, indexSize, DirectValues());
+        
+        auto gapCloseStart = std::chrono::steady_clock::now();
+        
+        closeGaps(deletedIdxs2, remapIdxs, indexSize, range, mergeIO, DirectValues());
+        
+        
+        mergeBytes += deletedIdxs2.size() * (sizeof(MapType) + sizeof(YType));
+        
+        auto switchStart = std::chrono::steady_clock::now();
+        
+        commitBack(JournaledMap());
+        
+        auto lockStart = std::chrono::steady_clock::now();
         
         _mutex.lock();
         
-        backField.clear();
+        locked = std::chrono::steady_clock::now();
         
+        backField.clear();
+        backField.setWindowWidth(_mergeTuner.windowWidth());
+        _backSpilled.reset();
         
-        _doubleSyncedMMapWrapper.resize(indexSize);
-        _doubleSyncedMMapWrapper.switchMMaps();
+        _fieldBudget->update(_backFieldBytes, 0);
+        _backFieldBytes = 0;
         
+        _positionMap.switchMMaps();
+        _mergedWatermark.store(0, std::memory_order_relaxed);
         
+        if (_yValMMapWrapper)
         {
             std::unique_lock<std::mutex> lock(_yValMutex);
-            _yValMMapWrapper->resize(indexSize);
+            truncateValues(indexSize, StagedValues());
         }
         
+        _writingCore = false;
+        
         _mutex.unlock();
+        
+        recordLockTimes(lockStart, locked, std::chrono::steady_clock::now());
+        
+        applyBack(JournaledMap());
+        
+        auto mergeEnd = std::chrono::steady_clock::now();
+        
+        _mergeThrottle->removeDirtyPages(mergeIO.dirtyPages);
+        
+        size_t mergeMicros = micros(mergeEnd - mergeStart);
+        
+        _metrics.add(DDIndexMetrics::Merges);
+        _metrics.add(DDIndexMetrics::MergedOps, mergingOps);
+        _metrics.add(DDIndexMetrics::MergeMicros, mergeMicros);
+        _metrics.add(DDIndexMetrics::MergeRewriteMicros, micros(deleteCollectStart - rewriteStart));
+        _metrics.add(DDIndexMetrics::MergeDeleteCollectMicros, micros(gapCloseStart - deleteCollectStart));
+        _metrics.add(DDIndexMetrics::MergeGapCloseMicros, micros(switchStart - gapCloseStart));
+        _metrics.add(DDIndexMetrics::MergeSwitchMicros, micros(mergeEnd - switchStart));
+        _metrics.add(DDIndexMetrics::MergeBytes, mergeBytes);
+        _metrics.set(DDIndexMetrics::MergingOps, 0);
+        _metrics.set(DDIndexMetrics::LastMergeMicros, mergeMicros);
+        _metrics.setMax(DDIndexMetrics::MaxMergeMicros, mergeMicros);
+        
+        DD_TRACE_COMPLETE("DDIndex", "rewrite", rewriteStart, deleteCollectStart);
+        DD_TRACE_COMPLETE("DDIndex", "delete collect", deleteCollectStart, gapCloseStart);
+        DD_TRACE_COMPLETE("DDIndex", "gap close", gapCloseStart, switchStart);
+        DD_TRACE_COMPLETE("DDIndex", "switch", switchStart, mergeEnd);
     }
 };
 
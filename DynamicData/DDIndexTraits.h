@@ -0,0 +1,114 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDIndexTraits_h
+#define DynamicData_DDIndexTraits_h
+
+#include <type_traits>
+
+/*
+ * Compile time options of DDIndex, the third template parameter. The defaults keep the layout
+ * of a map of offsets next to a file of values.
+ */
+template<typename YType>
+class DDIndexTraits
+{
+public:
+    
+    //the two position maps hold the values themselves, a get reads one map.
+    static const bool DirectValues = false;
+    
+    //one position map plus a journal of the entries a merge changes, instead of two full maps.
+    static const bool JournaledMap = false;
+    
+    //insertIdx appends the value to the value file, the pending operations only hold its offset.
+    static const bool StagedValues = false;
+    
+    //get and size share the index lock, the writers and the merge switch take it exclusively.
+    static const bool SharedReads = false;
+};
+
+/*
+ * DirectValues for small trivially copyable values, e.g. DDIndex<unsigned long, unsigned long,
+ * DDDirectValueTraits<unsigned long>>. Every merge rewrites the whole map, so a value should not
+ * be much bigger than an offset. The files are not compatible with the default layout.
+ */
+template<typename YType, size_t MaxValueSize = 16>
+class DDDirectValueTraits : public DDIndexTraits<YType>
+{
+    static_assert(std::is_trivially_copyable<YType>::value, "DDDirectValueTraits error YType is not trivially copyable");
+    static_assert(sizeof(YType) <= MaxValueSize, "DDDirectValueTraits error sizeof(YType) > MaxValueSize");
+    
+public:
+    
+    static const bool DirectValues = true;
+};
+
+/*
+ * JournaledMap on top of other traits, e.g. DDJournaledMapTraits<unsigned long,
+ * DDDirectValueTraits<unsigned long>>. The storage of the positions halves and a merge writes the
+ * changed entries twice instead of the whole map once. The files are not compatible with the
+ * double map layout.
+ */
+template<typename YType, class BaseTraits = DDIndexTraits<YType>>
+class DDJournaledMapTraits : public BaseTraits
+{
+public:
+    
+    static const bool JournaledMap = true;
+};
+
+/*
+ * StagedValues on top of other traits, for big values which should not wait in memory for the
+ * merge, e.g. DDStagedValueTraits<IndexObj>. The merge maps the staged offsets instead of copying
+ * the values. Overwritten staged values take space in the value file until the next merge. Can
+ * not be combined with DirectValues.
+ */
+template<typename YType, class BaseTraits = DDIndexTraits<YType>>
+class DDStagedValueTraits : public BaseTraits
+{
+public:
+    
+    static const bool StagedValues = true;
+};
+
+/*
+ * SharedReads on top of other traits, for read heavy loads with many reader threads, e.g.
+ * DDSharedReadTraits<IndexObj>. The gets take the index lock shared, every write pays a bit more
+ * for the reader writer lock.
+ */
+template<typename YType, class BaseTraits = DDIndexTraits<YType>>
+class DDSharedReadTraits : public BaseTraits
+{
+public:
+    
+    static const bool SharedReads = true;
+};
+
+#endif
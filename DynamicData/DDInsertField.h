@@ -33,6 +33,7 @@
 #include <vector>
 #include <deque>
 #include <set>
+#include <limits>
 
 #include "DDFieldIterator.h"
 #include "DDBaseSet.h"
@@ -117,7 +118,14 @@ private:
         return leafElement.diffImp(*leafElement.basePtr());
     }
     
-    typedef DDBaseSet<IdxType, Element2, BaseElement, 40> InsertContainer;
+public:
+    
+    //initial bucket width of the insert container.
+    static const IdxType DefaultWindowWidth = 40;
+    
+private:
+    
+    typedef DDBaseSet<IdxType, Element2, BaseElement, DefaultWindowWidth> InsertContainer;
     //typedef DDBaseVec<IdxType, Element2, BaseElement, 15> InsertContainer;
     
 public:
@@ -217,6 +225,20 @@ public:
         
         return evalImpl(idx, biggerThanItr, hasCacheElement, cachedElement);
     }
+    
+    //like eval, length is 1 for a cached element, else the distance to the next cached elements.
+    IdxType evalRun(IdxType idx, IdxType& length, bool& hasCacheElement, CachedElement& cachedElement)
+    {
+        auto biggerThanItr = _ddBaseSetPtr->equalRange(idx);
+        
+        IdxType res = evalImpl(idx, biggerThanItr, hasCacheElement, cachedElement);
+        
+        if (hasCacheElement) length = 1;
+        else if (biggerThanItr != _ddBaseSetPtr->end()) length = biggerThanItr->idx() - biggerThanItr->cachedElements.size() - idx;
+        else length = std::numeric_limits<IdxType>::max();
+        
+        return res;
+    }
        
     /*
     void debugPrint()
@@ -238,6 +260,27 @@ public:
     {
         _ddBaseSetPtr->clear();
     }
+    
+    //
+    //tuning interface.
+    typedef typename InsertContainer::WalkStats WalkStats;
+    
+    void setWindowWidth(IdxType windowWidth)
+    {
+        _ddBaseSetPtr->setWindowWidth(windowWidth);
+    }
+    
+    IdxType windowWidth() const
+    {
+        return _ddBaseSetPtr->windowWidth();
+    }
+    
+    const WalkStats& walkStats() const
+    {
+        return _ddBaseSetPtr->walkStats();
+    }
+    //
+    //
 
 private:
     std::unique_ptr<InsertContainer> _ddBaseSetPtr;
@@ -31,8 +31,9 @@
 #ifndef DynamicData_DDLoopReduce_h
 #define DynamicData_DDLoopReduce_h
 
-#include <list>
-#include "DDSpawn.h"
+#include <mutex>
+#include "DDThreadPool.h"
+#include "DDTraceEvents.h"
 
 template<typename IdxType>
 class DDLoopReduce
@@ -40,7 +41,8 @@ class DDLoopReduce
 public:
     
     DDLoopReduce(size_t maxNumOfThreads) :
-        _ddSpawn(maxNumOfThreads)
+        _maxNumOfThreads(maxNumOfThreads),
+        _threadPool(DDThreadPool::SHARED())
     {
         
     }
@@ -48,69 +50,23 @@ public:
     DDLoopReduce(const DDLoopReduce&) = delete;
     const DDLoopReduce& operator=(const DDLoopReduce&) = delete;
 
-    void reduce(std::function<void (IdxType inIdx)> func, IdxType range, IdxType slice)
+    //calls func(idx) for every idx in [0, range). slice is the smallest chunk handed to a thread.
+    template<class Func>
+    void reduce(const Func& func, IdxType range, IdxType slice)
     {
-        _reduceMutex.lock();
+        std::unique_lock<std::mutex> lock(_reduceMutex);
         
-        assert(range >= slice);
-        
-        bool done;
-        IdxType currIdx = 0;
-        IdxType currRange = 0;
+        DD_TRACE_SPAN("DDLoopReduce", "reduce");
         
-        while(true)
-        {
-            currIdx += currRange;
-            currRange = slicesRange(currIdx, slice, range, done);
-            
-            _ddSpawn.runAsyncBlocking([func, currIdx, currRange]()
-            {
-                IdxType idx;
-                for (IdxType i=0; i<currRange; i++)
-                {
-                    idx = i+currIdx;
-                    
-                    func(idx);
-                }
-            });
-            
-            if (done) break;
-        }
-        
-        _ddSpawn.joinAllThreads();
+        assert(range >= slice);
         
-        _reduceMutex.unlock();
+        _threadPool->parallelFor((IdxType)0, range, slice, func, _maxNumOfThreads);
     }
     
 private:
     std::mutex _reduceMutex;
-    DDSpawn _ddSpawn;
-    
-    void compSliceAsync(IdxType startIdx, IdxType sRange, std::function<void (IdxType inIdx)> func)
-    {
-        IdxType idx;
-        for (IdxType i=0; i<sRange; i++)
-        {
-            idx = i+startIdx;
-            
-            func(idx);
-        }
-    }
-    
-    IdxType slicesRange(IdxType currIdx, IdxType slice, IdxType totalRange, bool& done)
-    {
-        done = false;
-        
-        IdxType sRange = slice;
-        
-        if (currIdx + sRange > totalRange)
-        {
-            done = true;
-            sRange = totalRange - currIdx;
-        }
-        
-        return sRange;
-    }
+    size_t _maxNumOfThreads;
+    DDThreadPool* _threadPool;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,319 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDMergeScheduler_h
+#define DynamicData_DDMergeScheduler_h
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "DDUtils.h"
+
+/*
+ * Process wide scheduler for the background merges of all the DDIndex instances.
+ *
+ * A client notifies the scheduler when it gets pending operations. A bounded pool of merge
+ * workers picks the queued client with the highest priority, where the priority grows with the
+ * number of pending operations, the reads since the last merge and the time the operations are
+ * waiting. A client is eligible once its operations waited maxDelay or once it has more than
+ * urgentPendingSize of them. At most maxConcurrentMerges merges run at the same time.
+ */
+class DDMergeScheduler
+{
+public:
+    
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::milliseconds millisec;
+    
+    class Client
+    {
+    public:
+        virtual ~Client() {}
+        
+        //number of operations waiting for a merge.
+        virtual size_t pendingSize() = 0;
+        
+        //reads since the last merge.
+        virtual size_t readCount() = 0;
+        
+        //merges the pending operations into the core.
+        virtual void merge() = 0;
+    };
+    
+    class Config
+    {
+    public:
+        Config() :
+            maxConcurrentMerges(std::max(1u, std::thread::hardware_concurrency() / 2)),
+            maxDelay(1000),
+            urgentPendingSize(100000),
+            pendingWeight(1.0),
+            readWeight(0.1),
+            ageWeight(10.0)
+        {}
+        
+        size_t maxConcurrentMerges;
+        
+        millisec maxDelay;
+        size_t urgentPendingSize;
+        
+        //priority = pendingWeight * pendingSize + readWeight * readCount + ageWeight * age in ms.
+        double pendingWeight;
+        double readWeight;
+        double ageWeight;
+    };
+    
+    DDMergeScheduler() :
+        _runningMerges(0),
+        _stop(false)
+    {
+        setConfig(Config());
+    }
+    
+    ~DDMergeScheduler()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        
+        _cond.notify_all();
+        
+        for (auto itr = _workers.begin(); itr != _workers.end(); itr++)
+        {
+            itr->join();
+        }
+    }
+    
+    DDMergeScheduler(const DDMergeScheduler&) = delete;
+    const DDMergeScheduler& operator=(const DDMergeScheduler&) = delete;
+    
+    static DDMergeScheduler* SHARED()
+    {
+        return DDUtils::SHARED<DDMergeScheduler>();
+    }
+    
+    void setConfig(const Config& config)
+    {
+        assert(config.maxConcurrentMerges > 0);
+        
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        _config = config;
+        
+        //workers are only added, the ones above the limit stay idle.
+        while (_workers.size() < _config.maxConcurrentMerges)
+        {
+            _workers.push_back(std::thread(&DDMergeScheduler::workerLoop, this));
+        }
+        
+        _cond.notify_all();
+    }
+    
+    Config config()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _config;
+    }
+    
+    void add(Client* client)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        assert(!_entries.count(client));
+        _entries[client] = Entry();
+    }
+    
+    //blocks until a running merge of the client is done.
+    void remove(Client* client)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        auto itr = _entries.find(client);
+        if (itr == _entries.end()) return;
+        
+        itr->second.removed = true;
+        
+        while (itr->second.running)
+        {
+            _mergeDoneCond.wait(lock);
+        }
+        
+        _entries.erase(itr);
+    }
+    
+    //has to be called without holding any lock the client takes in pendingSize or readCount.
+    void notify(Client* client)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        auto itr = _entries.find(client);
+        if (itr == _entries.end() || itr->second.removed) return;
+        
+        if (!itr->second.queued)
+        {
+            itr->second.queued = true;
+            itr->second.pendingSince = clock::now();
+        }
+        
+        _cond.notify_one();
+    }
+    
+    size_t runningMerges()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _runningMerges;
+    }
+    
+    size_t queuedClients()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        size_t count = 0;
+        for (auto itr = _entries.begin(); itr != _entries.end(); itr++)
+        {
+            if (itr->second.queued) count++;
+        }
+        
+        return count;
+    }
+    
+private:
+    
+    class Entry
+    {
+    public:
+        Entry() :
+            queued(false),
+            running(false),
+            removed(false)
+        {}
+        
+        bool queued;
+        bool running;
+        bool removed;
+        clock::time_point pendingSince;
+    };
+    
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::condition_variable _mergeDoneCond;
+    
+    std::map<Client*, Entry> _entries;
+    std::vector<std::thread> _workers;
+    
+    Config _config;
+    size_t _runningMerges;
+    bool _stop;
+    
+    //returns the eligible client with the highest priority or the time the next one gets eligible.
+    Client* nextClient(clock::time_point& wakeUp)
+    {
+        Client* best = 0;
+        double bestPriority = -1;
+        
+        clock::time_point now = clock::now();
+        wakeUp = now + _config.maxDelay;
+        
+        for (auto itr = _entries.begin(); itr != _entries.end(); itr++)
+        {
+            Entry& entry = itr->second;
+            
+            if (!entry.queued || entry.running || entry.removed) continue;
+            
+            size_t pendingSize = itr->first->pendingSize();
+            
+            millisec age = std::chrono::duration_cast<millisec>(now - entry.pendingSince);
+            
+            if (age < _config.maxDelay && pendingSize < _config.urgentPendingSize)
+            {
+                wakeUp = std::min(wakeUp, entry.pendingSince + _config.maxDelay);
+                continue;
+            }
+            
+            double priority = _config.pendingWeight * pendingSize + _config.readWeight * itr->first->readCount() + _config.ageWeight * age.count();
+            
+            if (priority > bestPriority)
+            {
+                best = itr->first;
+                bestPriority = priority;
+            }
+        }
+        
+        return best;
+    }
+    
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        while (!_stop)
+        {
+            clock::time_point wakeUp = clock::now() + _config.maxDelay;
+            Client* client = 0;
+            
+            if (_runningMerges < _config.maxConcurrentMerges) client = nextClient(wakeUp);
+            
+            if (!client)
+            {
+                _cond.wait_until(lock, wakeUp);
+                continue;
+            }
+            
+            Entry& entry = _entries[client];
+            
+            //operations which arrive during the merge queue the client again.
+            entry.queued = false;
+            entry.running = true;
+            _runningMerges++;
+            
+            lock.unlock();
+            
+            client->merge();
+            
+            lock.lock();
+            
+            _runningMerges--;
+            
+            //the entry can not be erased while it is running.
+            Entry& doneEntry = _entries[client];
+            doneEntry.running = false;
+            
+            _mergeDoneCond.notify_all();
+            _cond.notify_one();
+        }
+    }
+};
+
+#endif
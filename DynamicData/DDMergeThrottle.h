@@ -0,0 +1,274 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDMergeThrottle_h
+#define DynamicData_DDMergeThrottle_h
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "DDUtils.h"
+
+/*
+ * Process wide I/O budget for the background merges.
+ *
+ * Merges report the bytes they wrote after every chunk and are put to sleep by a token bucket
+ * (bytesPerSec, burstBytes) when they are over budget. The dirty pages a merge has written but
+ * not yet synced are accounted too; a merge which pushes the total above maxDirtyPages has to
+ * sync its written ranges before it continues.
+ *
+ * If targetGetLatency is set, DDIndex::get feeds sampled latencies into the throttle. While
+ * the smoothed latency is above the target the rate is halved (down to minRateFraction), below
+ * the target it recovers additively. With an unlimited rate the observed merge rate is used as
+ * the base for the adaptive rate.
+ */
+class DDMergeThrottle
+{
+public:
+    
+    typedef std::chrono::steady_clock clock;
+    typedef std::chrono::microseconds microsec;
+    
+    class Config
+    {
+    public:
+        Config() :
+            bytesPerSec(0),
+            burstBytes(4 << 20),
+            maxDirtyPages(0),
+            targetGetLatency(0),
+            minRateFraction(0.05)
+        {}
+        
+        //0 means unlimited.
+        double bytesPerSec;
+        double burstBytes;
+        
+        //0 means unlimited.
+        size_t maxDirtyPages;
+        
+        //0 disables the latency feedback.
+        microsec targetGetLatency;
+        double minRateFraction;
+    };
+    
+    DDMergeThrottle() :
+        _tokens(0),
+        _rateFactor(1.0),
+        _observedRate(0),
+        _windowBytes(0),
+        _latencyAvg(0),
+        _dirtyPages(0),
+        _throttleEvents(0)
+    {
+        _lastRefill = clock::now();
+        _windowStart = _lastRefill;
+        _lastAdapt = _lastRefill;
+    }
+    
+    DDMergeThrottle(const DDMergeThrottle&) = delete;
+    const DDMergeThrottle& operator=(const DDMergeThrottle&) = delete;
+    
+    static DDMergeThrottle* SHARED()
+    {
+        return DDUtils::SHARED<DDMergeThrottle>();
+    }
+    
+    void setConfig(const Config& config)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        _config = config;
+        _tokens = std::min(_tokens, _config.burstBytes);
+        _rateFactor = 1.0;
+    }
+    
+    Config config()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _config;
+    }
+    
+    //called by a merge between two chunks, sleeps while the merge is over budget.
+    //returns the time the merge had to wait.
+    microsec acquire(size_t bytes)
+    {
+        microsec wait(0);
+        
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            
+            clock::time_point now = clock::now();
+            observeRate(bytes, now);
+            
+            double rate = effectiveRate();
+            
+            if (rate > 0)
+            {
+                refill(rate, now);
+                
+                //the tokens can become negative, the debt is paid by sleeping.
+                _tokens -= bytes;
+                
+                if (_tokens < 0)
+                {
+                    wait = microsec((long long)(-_tokens / rate * 1000000.0));
+                }
+            }
+        }
+        
+        if (wait.count() > 0)
+        {
+            _throttleEvents.fetch_add(1, std::memory_order_relaxed);
+            std::this_thread::sleep_for(wait);
+        }
+        
+        return wait;
+    }
+    
+    //returns true if the merge has to sync its dirty pages before it continues.
+    bool addDirtyPages(size_t pages)
+    {
+        size_t maxDirtyPages;
+        
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            maxDirtyPages = _config.maxDirtyPages;
+        }
+        
+        size_t dirtyPages = _dirtyPages.fetch_add(pages, std::memory_order_relaxed) + pages;
+        
+        return maxDirtyPages > 0 && dirtyPages > maxDirtyPages;
+    }
+    
+    void removeDirtyPages(size_t pages)
+    {
+        _dirtyPages.fetch_sub(pages, std::memory_order_relaxed);
+    }
+    
+    void observeGetLatency(microsec latency)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        if (_config.targetGetLatency.count() == 0) return;
+        
+        if (_latencyAvg == 0) _latencyAvg = latency.count();
+        else _latencyAvg = 0.9 * _latencyAvg + 0.1 * latency.count();
+        
+        clock::time_point now = clock::now();
+        
+        //adapt at most every 100ms, the merge needs some time to react.
+        if (now - _lastAdapt < std::chrono::milliseconds(100)) return;
+        _lastAdapt = now;
+        
+        if (_latencyAvg > _config.targetGetLatency.count())
+        {
+            _rateFactor = std::max(_config.minRateFraction, _rateFactor * 0.5);
+        }
+        else
+        {
+            _rateFactor = std::min(1.0, _rateFactor + 0.05);
+        }
+    }
+    
+    size_t throttleEvents()
+    {
+        return _throttleEvents.load(std::memory_order_relaxed);
+    }
+    
+    size_t dirtyPages()
+    {
+        return _dirtyPages.load(std::memory_order_relaxed);
+    }
+    
+    //bytes per second the merges are currently allowed to write, 0 if unlimited.
+    double currentRate()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return effectiveRate();
+    }
+    
+private:
+    std::mutex _mutex;
+    Config _config;
+    
+    double _tokens;
+    clock::time_point _lastRefill;
+    
+    double _rateFactor;
+    
+    //merge write rate measured over windows of one second.
+    double _observedRate;
+    double _windowBytes;
+    clock::time_point _windowStart;
+    
+    double _latencyAvg;
+    clock::time_point _lastAdapt;
+    
+    std::atomic<size_t> _dirtyPages;
+    std::atomic<size_t> _throttleEvents;
+    
+    double effectiveRate()
+    {
+        double rate = _config.bytesPerSec;
+        
+        if (rate == 0 && _rateFactor < 1.0) rate = _observedRate;
+        
+        return rate * _rateFactor;
+    }
+    
+    void refill(double rate, clock::time_point now)
+    {
+        double elapsed = std::chrono::duration_cast<microsec>(now - _lastRefill).count() / 1000000.0;
+        
+        _tokens = std::min(_config.burstBytes, _tokens + elapsed * rate);
+        _lastRefill = now;
+    }
+    
+    void observeRate(size_t bytes, clock::time_point now)
+    {
+        _windowBytes += bytes;
+        
+        double elapsed = std::chrono::duration_cast<microsec>(now - _windowStart).count() / 1000000.0;
+        
+        if (elapsed >= 1.0)
+        {
+            //a throttled merge does not tell how fast it could write.
+            if (_rateFactor >= 1.0) _observedRate = _windowBytes / elapsed;
+            
+            _windowBytes = 0;
+            _windowStart = now;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,206 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDMergeTuner_h
+#define DynamicData_DDMergeTuner_h
+
+#include <mutex>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+
+/*
+ * Online cost model for the two magic numbers of the merge.
+ *
+ * WindowWidth: an insert into a DDBaseSet walks all the base nodes behind its bucket
+ * (~ P / WindowWidth) and the leaf nodes inside its bucket (~ WindowWidth). observeField()
+ * is fed with the walk lengths the field recorded while it was active and moves the width
+ * towards the point where both walks cost the same, which is the minimum of their sum.
+ *
+ * Merge chunk size: mapFuncts works through the index in chunks. observeMerge() is fed with
+ * the throughput of the rewrite loop and the chunk size is chosen such that one chunk takes
+ * about targetChunkDuration.
+ *
+ * The tuner is updated by the merge thread between merges and can be inspected from any thread.
+ */
+template<typename IdxType>
+class DDMergeTuner
+{
+public:
+    
+    typedef std::chrono::microseconds microsec;
+    
+    class Tuning
+    {
+    public:
+        Tuning() :
+            windowWidth(0),
+            mergeChunkSize(0),
+            autoTune(false),
+            baseWalkAvg(0),
+            leafWalkAvg(0),
+            mergeThroughput(0),
+            merges(0)
+        {}
+        
+        IdxType windowWidth;
+        IdxType mergeChunkSize;
+        bool autoTune;
+        
+        //average walk lengths of adjustNodesImp observed in the last merged field.
+        double baseWalkAvg;
+        double leafWalkAvg;
+        
+        //elements per second of the rewrite loop (smoothed).
+        double mergeThroughput;
+        
+        size_t merges;
+    };
+    
+    DDMergeTuner(IdxType windowWidth, IdxType mergeChunkSize) :
+        _autoTune(true),
+        _targetChunkDuration(2000)
+    {
+        _tuning.windowWidth = windowWidth;
+        _tuning.mergeChunkSize = mergeChunkSize;
+    }
+    
+    DDMergeTuner(const DDMergeTuner&) = delete;
+    const DDMergeTuner& operator=(const DDMergeTuner&) = delete;
+    
+    template<class WalkStats>
+    void observeField(const WalkStats& walkStats)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        //not enough samples for a decision.
+        if (walkStats.adjustCount < MinAdjustSamples) return;
+        
+        _tuning.baseWalkAvg = (double)walkStats.baseWalk / walkStats.adjustCount;
+        _tuning.leafWalkAvg = (double)walkStats.leafWalk / walkStats.adjustCount;
+        
+        if (!_autoTune) return;
+        
+        //base walk ~ 1/width, leaf walk ~ width -> the sum is minimal if both are equal.
+        double factor = std::sqrt((_tuning.baseWalkAvg + 1.0) / (_tuning.leafWalkAvg + 1.0));
+        
+        //dampen the step to avoid oscillations between two merges.
+        factor = std::max(0.5, std::min(2.0, factor));
+        
+        double windowWidth = _tuning.windowWidth * factor;
+        windowWidth = std::max((double)MinWindowWidth, std::min((double)MaxWindowWidth, windowWidth));
+        
+        _tuning.windowWidth = (IdxType)windowWidth;
+    }
+    
+    void observeMerge(IdxType elements, microsec duration)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        _tuning.merges++;
+        
+        if (elements < MinChunkSize || duration.count() <= 0) return;
+        
+        double throughput = (double)elements * 1000000.0 / (double)duration.count();
+        
+        if (_tuning.mergeThroughput == 0) _tuning.mergeThroughput = throughput;
+        else _tuning.mergeThroughput = 0.7 * _tuning.mergeThroughput + 0.3 * throughput;
+        
+        if (!_autoTune) return;
+        
+        double chunkSize = _tuning.mergeThroughput * _targetChunkDuration.count() / 1000000.0;
+        chunkSize = std::max((double)MinChunkSize, std::min((double)MaxChunkSize, chunkSize));
+        
+        _tuning.mergeChunkSize = (IdxType)chunkSize;
+    }
+    
+    IdxType windowWidth()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _tuning.windowWidth;
+    }
+    
+    IdxType mergeChunkSize()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _tuning.mergeChunkSize;
+    }
+    
+    Tuning tuning()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        Tuning tuning = _tuning;
+        tuning.autoTune = _autoTune;
+        
+        return tuning;
+    }
+    
+    //fixes the values and disables the auto tuning.
+    void setTuning(IdxType windowWidth, IdxType mergeChunkSize)
+    {
+        assert(windowWidth >= MinWindowWidth && mergeChunkSize > 0);
+        
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        _autoTune = false;
+        _tuning.windowWidth = windowWidth;
+        _tuning.mergeChunkSize = mergeChunkSize;
+    }
+    
+    void setAutoTune(bool autoTune)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _autoTune = autoTune;
+    }
+    
+    void setTargetChunkDuration(microsec targetChunkDuration)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _targetChunkDuration = targetChunkDuration;
+    }
+    
+private:
+    static const size_t MinAdjustSamples = 64;
+    
+    static const IdxType MinWindowWidth = 4;
+    static const IdxType MaxWindowWidth = 4096;
+    
+    static const IdxType MinChunkSize = 64;
+    static const IdxType MaxChunkSize = 1 << 20;
+    
+    std::mutex _mutex;
+    
+    Tuning _tuning;
+    bool _autoTune;
+    microsec _targetChunkDuration;
+};
+
+#endif
@@ -0,0 +1,395 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDMetrics_h
+#define DynamicData_DDMetrics_h
+
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <condition_variable>
+
+#include "DDUtils.h"
+
+//relaxed counter striped over cache lines, so that concurrent readers do not share a line.
+class DDMetricsCounter
+{
+public:
+    
+    DDMetricsCounter()
+    {
+        for (size_t i=0; i<NumOfStripes; i++) _stripes[i].value.store(0, std::memory_order_relaxed);
+    }
+    
+    DDMetricsCounter(const DDMetricsCounter&) = delete;
+    const DDMetricsCounter& operator=(const DDMetricsCounter&) = delete;
+    
+    void add(unsigned long long value)
+    {
+        size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % NumOfStripes;
+        _stripes[stripe].value.fetch_add(value, std::memory_order_relaxed);
+    }
+    
+    unsigned long long value() const
+    {
+        unsigned long long sum = 0;
+        
+        for (size_t i=0; i<NumOfStripes; i++) sum += _stripes[i].value.load(std::memory_order_relaxed);
+        
+        return sum;
+    }
+    
+private:
+    static const size_t NumOfStripes = 16;
+    
+    class Stripe
+    {
+    public:
+        std::atomic<unsigned long long> value;
+        char padding[64 - sizeof(std::atomic<unsigned long long>)];
+    };
+    
+    Stripe _stripes[NumOfStripes];
+};
+
+/*
+ * Metrics of one DDIndex. Counters only grow, gauges hold the last value.
+ * All updates are relaxed atomics; snapshot() reads them without stopping the index.
+ */
+class DDIndexMetrics
+{
+public:
+    
+    enum Counter
+    {
+        Inserts,
+        Deletes,
+        GetsFromActiveField,
+        GetsFromBackField,
+        GetsFromMMap,
+        Merges,
+        MergedOps,
+        MergeMicros,
+        MergeRewriteMicros,
+        MergeDeleteCollectMicros,
+        MergeGapCloseMicros,
+        MergeSwitchMicros,
+        MergeBytes,
+        LockSamples,
+        LockWaitMicros,
+        LockHoldMicros,
+        ThrottleEvents,
+        ThrottleMicros,
+        Reclusters,
+        ReclusterMoves,
+        ReclusterMicros,
+        Spills,
+        SpillMicros,
+        GetsFromSpill,
+        Handoffs,
+        GetsBelowWatermark,
+        LockedValueReads,
+        NumOfCounters
+    };
+    
+    enum Gauge
+    {
+        IndexSize,
+        PendingOps,
+        MergingOps,
+        LastMergeMicros,
+        MaxMergeMicros,
+        FileGrowths,
+        FragmentationPermille,
+        FieldBytes,
+        SealedBatches,
+        NumOfGauges
+    };
+    
+    class Snapshot
+    {
+    public:
+        Snapshot()
+        {
+            for (size_t i=0; i<NumOfCounters; i++) counters[i] = 0;
+            for (size_t i=0; i<NumOfGauges; i++) gauges[i] = 0;
+        }
+        
+        unsigned long long counter(Counter counter) const { return counters[counter]; }
+        unsigned long long gauge(Gauge gauge) const { return gauges[gauge]; }
+        
+        //counters counted since the earlier snapshot, the gauges are taken from this one.
+        Snapshot since(const Snapshot& earlier) const
+        {
+            Snapshot snapshot = *this;
+            
+            for (size_t i=0; i<NumOfCounters; i++) snapshot.counters[i] -= earlier.counters[i];
+            
+            return snapshot;
+        }
+        
+        //one line per value in the prometheus text format.
+        void writeText(std::ostream& out, const std::string& indexName) const
+        {
+            for (size_t i=0; i<NumOfCounters; i++)
+            {
+                out << "dd_" << counterName((Counter)i) << "_total{index=\"" << indexName << "\"} " << counters[i] << "\n";
+            }
+            
+            for (size_t i=0; i<NumOfGauges; i++)
+            {
+                out << "dd_" << gaugeName((Gauge)i) << "{index=\"" << indexName << "\"} " << gauges[i] << "\n";
+            }
+        }
+        
+        unsigned long long counters[NumOfCounters];
+        unsigned long long gauges[NumOfGauges];
+    };
+    
+    DDIndexMetrics()
+    {
+        for (size_t i=0; i<NumOfGauges; i++) _gauges[i].store(0, std::memory_order_relaxed);
+    }
+    
+    DDIndexMetrics(const DDIndexMetrics&) = delete;
+    const DDIndexMetrics& operator=(const DDIndexMetrics&) = delete;
+    
+    void add(Counter counter, unsigned long long value = 1)
+    {
+        _counters[counter].add(value);
+    }
+    
+    void set(Gauge gauge, unsigned long long value)
+    {
+        _gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+    
+    void setMax(Gauge gauge, unsigned long long value)
+    {
+        unsigned long long curr = _gauges[gauge].load(std::memory_order_relaxed);
+        
+        while (value > curr && !_gauges[gauge].compare_exchange_weak(curr, value, std::memory_order_relaxed)) {}
+    }
+    
+    Snapshot snapshot() const
+    {
+        Snapshot snapshot;
+        
+        for (size_t i=0; i<NumOfCounters; i++) snapshot.counters[i] = _counters[i].value();
+        for (size_t i=0; i<NumOfGauges; i++) snapshot.gauges[i] = _gauges[i].load(std::memory_order_relaxed);
+        
+        return snapshot;
+    }
+    
+    static const char* counterName(Counter counter)
+    {
+        static const char* names[NumOfCounters] =
+        {
+            "inserts",
+            "deletes",
+            "gets_active_field",
+            "gets_back_field",
+            "gets_mmap",
+            "merges",
+            "merged_ops",
+            "merge_micros",
+            "merge_rewrite_micros",
+            "merge_delete_collect_micros",
+            "merge_gap_close_micros",
+            "merge_switch_micros",
+            "merge_bytes",
+            "lock_samples",
+            "lock_wait_micros",
+            "lock_hold_micros",
+            "throttle_events",
+            "throttle_micros",
+            "reclusters",
+            "recluster_moves",
+            "recluster_micros",
+            "spills",
+            "spill_micros",
+            "gets_from_spill",
+            "handoffs",
+            "gets_below_watermark",
+            "locked_value_reads"
+        };
+        
+        return names[counter];
+    }
+    
+    static const char* gaugeName(Gauge gauge)
+    {
+        static const char* names[NumOfGauges] =
+        {
+            "index_size",
+            "pending_ops",
+            "merging_ops",
+            "last_merge_micros",
+            "max_merge_micros",
+            "file_growths",
+            "fragmentation_permille",
+            "field_bytes",
+            "sealed_batches"
+        };
+        
+        return names[gauge];
+    }
+    
+private:
+    DDMetricsCounter _counters[NumOfCounters];
+    std::atomic<unsigned long long> _gauges[NumOfGauges];
+};
+
+/*
+ * Collects the metrics of all registered indices in the text format. writeFile can be
+ * called directly or periodically by startFileExport, the file is replaced atomically so
+ * a scraper never reads a half written file.
+ */
+class DDMetricsRegistry
+{
+public:
+    
+    typedef std::function<DDIndexMetrics::Snapshot ()> SnapshotFunc;
+    
+    DDMetricsRegistry() :
+        _nextId(0),
+        _exportRunning(false)
+    {}
+    
+    ~DDMetricsRegistry()
+    {
+        stopFileExport();
+    }
+    
+    DDMetricsRegistry(const DDMetricsRegistry&) = delete;
+    const DDMetricsRegistry& operator=(const DDMetricsRegistry&) = delete;
+    
+    static DDMetricsRegistry* SHARED()
+    {
+        return DDUtils::SHARED<DDMetricsRegistry>();
+    }
+    
+    size_t add(const std::string& name, SnapshotFunc snapshotFunc)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        size_t id = _nextId++;
+        _sources[id] = std::make_pair(name, snapshotFunc);
+        
+        return id;
+    }
+    
+    void remove(size_t id)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sources.erase(id);
+    }
+    
+    std::string exportText()
+    {
+        std::stringstream out;
+        
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        for (auto itr = _sources.begin(); itr != _sources.end(); itr++)
+        {
+            itr->second.second().writeText(out, itr->second.first);
+        }
+        
+        return out.str();
+    }
+    
+    bool writeFile(const std::string& path)
+    {
+        std::string tempPath = path + ".tmp";
+        
+        {
+            std::ofstream file(tempPath.c_str(), std::ios::trunc);
+            if (!file) return false;
+            
+            file << exportText();
+            if (!file) return false;
+        }
+        
+        return std::rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+    
+    void startFileExport(const std::string& path, std::chrono::milliseconds interval)
+    {
+        stopFileExport();
+        
+        std::unique_lock<std::mutex> lock(_exportMutex);
+        
+        _exportRunning = true;
+        _exportThread = std::thread([this, path, interval]()
+        {
+            std::unique_lock<std::mutex> lock(_exportMutex);
+            
+            while (_exportRunning)
+            {
+                lock.unlock();
+                writeFile(path);
+                lock.lock();
+                
+                _exportCond.wait_for(lock, interval);
+            }
+        });
+    }
+    
+    void stopFileExport()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_exportMutex);
+            _exportRunning = false;
+        }
+        
+        _exportCond.notify_all();
+        
+        if (_exportThread.joinable()) _exportThread.join();
+    }
+    
+private:
+    std::mutex _mutex;
+    std::map<size_t, std::pair<std::string, SnapshotFunc>> _sources;
+    size_t _nextId;
+    
+    std::mutex _exportMutex;
+    std::condition_variable _exportCond;
+    std::thread _exportThread;
+    bool _exportRunning;
+};
+
+#endif
@@ -0,0 +1,394 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDOpTrace_h
+#define DynamicData_DDOpTrace_h
+
+#include <cstdio>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+
+#include "DDHistogram.h"
+
+/*
+ * Binary op log of an index.
+ *
+ * header:  "DDOT" | version (u32) | sizeof(IdxType) (u32) | sizeof(YType) (u32)
+ * record:  op (u8) | nanoseconds since the previous record (varint) | idx (varint) | value (inserts only)
+ *
+ * Values are written as raw bytes, so YType has to be trivially copyable.
+ */
+class DDOpTrace
+{
+public:
+    
+    enum Op
+    {
+        Get = 0,
+        Insert = 1,
+        Delete = 2
+    };
+    
+    static const uint32_t Version = 1;
+    
+    class Header
+    {
+    public:
+        char magic[4];
+        uint32_t version;
+        uint32_t idxSize;
+        uint32_t valueSize;
+    };
+    
+    //writes the records of all threads in the order they get the writer's lock.
+    class Writer
+    {
+    public:
+        
+        Writer(const std::string& path, uint32_t idxSize, uint32_t valueSize) :
+            _file(std::fopen(path.c_str(), "wb")),
+            _last(std::chrono::steady_clock::now())
+        {
+            if (!_file)
+            {
+                std::cout << "DDOpTrace: error opening " << path << std::endl;
+                return;
+            }
+            
+            Header header;
+            std::memcpy(header.magic, "DDOT", 4);
+            header.version = Version;
+            header.idxSize = idxSize;
+            header.valueSize = valueSize;
+            
+            std::fwrite(&header, sizeof(Header), 1, _file);
+        }
+        
+        ~Writer()
+        {
+            if (_file)
+            {
+                flush();
+                std::fclose(_file);
+            }
+        }
+        
+        Writer(const Writer&) = delete;
+        const Writer& operator=(const Writer&) = delete;
+        
+        bool isOpen() { return _file != 0; }
+        
+        void write(Op op, uint64_t idx, const void* value, size_t valueSize)
+        {
+            if (!_file) return;
+            
+            std::unique_lock<std::mutex> lock(_mutex);
+            
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            uint64_t delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _last).count();
+            _last = now;
+            
+            _buffer.push_back((char)op);
+            writeVarint(delta);
+            writeVarint(idx);
+            
+            if (value) _buffer.insert(_buffer.end(), (const char*)value, (const char*)value + valueSize);
+            
+            if (_buffer.size() >= BufferSize) flushBuffer();
+        }
+        
+        void flush()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            
+            flushBuffer();
+            std::fflush(_file);
+        }
+        
+    private:
+        static const size_t BufferSize = 1 << 16;
+        
+        std::FILE* _file;
+        std::mutex _mutex;
+        std::vector<char> _buffer;
+        std::chrono::steady_clock::time_point _last;
+        
+        void writeVarint(uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                _buffer.push_back((char)(value | 0x80));
+                value >>= 7;
+            }
+            
+            _buffer.push_back((char)value);
+        }
+        
+        void flushBuffer()
+        {
+            if (!_buffer.empty()) std::fwrite(&_buffer[0], 1, _buffer.size(), _file);
+            _buffer.clear();
+        }
+    };
+    
+    class Record
+    {
+    public:
+        Op op;
+        
+        //since the start of the trace.
+        uint64_t nanos;
+        uint64_t idx;
+        std::vector<char> value;
+    };
+    
+    class Reader
+    {
+    public:
+        
+        Reader(const std::string& path) :
+            _file(std::fopen(path.c_str(), "rb")),
+            _nanos(0),
+            _valid(false)
+        {
+            if (!_file)
+            {
+                std::cout << "DDOpTrace: error opening " << path << std::endl;
+                return;
+            }
+            
+            _valid = std::fread(&_header, sizeof(Header), 1, _file) == 1 && std::memcmp(_header.magic, "DDOT", 4) == 0 && _header.version == Version;
+            
+            if (!_valid) std::cout << "DDOpTrace: " << path << " is not a trace" << std::endl;
+        }
+        
+        ~Reader()
+        {
+            if (_file) std::fclose(_file);
+        }
+        
+        Reader(const Reader&) = delete;
+        const Reader& operator=(const Reader&) = delete;
+        
+        bool valid() { return _valid; }
+        const Header& header() { return _header; }
+        
+        //false at the end of the trace, on a truncated record or an unknown op.
+        bool next(Record& record)
+        {
+            if (!_valid) return false;
+            
+            int op = std::fgetc(_file);
+            if (op == EOF) return false;
+            
+            //a corrupt or foreign file, the rest of it can not be read.
+            if (op > Delete)
+            {
+                std::cout << "DDOpTrace: unknown op " << op << std::endl;
+                _valid = false;
+                return false;
+            }
+            
+            uint64_t delta;
+            
+            if (!readVarint(delta) || !readVarint(record.idx)) return false;
+            
+            _nanos += delta;
+            
+            record.op = (Op)op;
+            record.nanos = _nanos;
+            record.value.resize(record.op == Insert ? _header.valueSize : 0);
+            
+            if (!record.value.empty() && std::fread(&record.value[0], 1, record.value.size(), _file) != record.value.size()) return false;
+            
+            return true;
+        }
+        
+    private:
+        std::FILE* _file;
+        Header _header;
+        uint64_t _nanos;
+        bool _valid;
+        
+        bool readVarint(uint64_t& value)
+        {
+            value = 0;
+            
+            for (unsigned int shift = 0; shift < 64; shift += 7)
+            {
+                int byte = std::fgetc(_file);
+                if (byte == EOF) return false;
+                
+                value |= (uint64_t)(byte & 0x7F) << shift;
+                
+                if (!(byte & 0x80)) return true;
+            }
+            
+            return false;
+        }
+    };
+    
+    class ReplayResult
+    {
+    public:
+        ReplayResult() : operations(0), skipped(0) {}
+        
+        size_t operations;
+        
+        //ops which did not fit the size of the replayed index, e.g. a truncated trace.
+        size_t skipped;
+        
+        std::chrono::microseconds duration;
+        DDHistogram latency[3];
+    };
+    
+    /*
+     * Replays a trace against any index with get, insertIdx, deleteIdx and size, e.g. a DDIndex with
+     * another field or storage policy. recordedSpeed keeps the recorded gaps between the ops,
+     * otherwise the ops run back to back.
+     */
+    template<typename IdxType, typename YType, class Index>
+    static ReplayResult replay(Reader& reader, Index& index, bool recordedSpeed, size_t latencySampleRate = 1)
+    {
+        static_assert(std::is_trivially_copyable<YType>::value, "DDOpTrace error YType is not trivially copyable");
+        
+        typedef std::chrono::steady_clock clock;
+        
+        ReplayResult result;
+        
+        if (!reader.valid() || reader.header().idxSize != sizeof(IdxType) || reader.header().valueSize != sizeof(YType))
+        {
+            std::cout << "DDOpTrace: the trace does not match the index types" << std::endl;
+            return result;
+        }
+        
+        if (latencySampleRate == 0) latencySampleRate = 1;
+        
+        Record record;
+        clock::time_point start = clock::now();
+        
+        while (reader.next(record))
+        {
+            if (recordedSpeed) std::this_thread::sleep_until(start + std::chrono::nanoseconds(record.nanos));
+            
+            IdxType idx = (IdxType)record.idx;
+            IdxType size = index.size();
+            
+            if ((record.op == Insert && idx > size) || (record.op != Insert && idx >= size))
+            {
+                result.skipped++;
+                continue;
+            }
+            
+            bool sample = result.operations++ % latencySampleRate == 0;
+            clock::time_point opStart;
+            if (sample) opStart = clock::now();
+            
+            if (record.op == Get)
+            {
+                index.get(idx);
+            }
+            else if (record.op == Insert)
+            {
+                YType value;
+                std::memcpy(&value, &record.value[0], sizeof(YType));
+                
+                index.insertIdx(idx, value);
+            }
+            else
+            {
+                index.deleteIdx(idx);
+            }
+            
+            if (sample) result.latency[record.op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - opStart).count());
+        }
+        
+        result.duration = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+        
+        return result;
+    }
+};
+
+/*
+ * Forwards to an index and logs every call, e.g.
+ *
+ *   DDOpTrace::Writer writer("index.trace", sizeof(unsigned int), sizeof(Value));
+ *   DDTracingIndex<unsigned int, Value, DDIndex<unsigned int, Value>> traced(index, writer);
+ */
+template<typename IdxType, typename YType, class Index>
+class DDTracingIndex
+{
+    static_assert(std::is_trivially_copyable<YType>::value, "DDTracingIndex error YType is not trivially copyable");
+    
+public:
+    
+    DDTracingIndex(Index& index, DDOpTrace::Writer& writer) :
+        _index(index),
+        _writer(writer)
+    {}
+    
+    DDTracingIndex(const DDTracingIndex&) = delete;
+    const DDTracingIndex& operator=(const DDTracingIndex&) = delete;
+    
+    YType get(IdxType idx)
+    {
+        _writer.write(DDOpTrace::Get, idx, 0, 0);
+        return _index.get(idx);
+    }
+    
+    void insertIdx(IdxType idx, YType yValue)
+    {
+        _writer.write(DDOpTrace::Insert, idx, &yValue, sizeof(YType));
+        _index.insertIdx(idx, yValue);
+    }
+    
+    void deleteIdx(IdxType idx)
+    {
+        _writer.write(DDOpTrace::Delete, idx, 0, 0);
+        _index.deleteIdx(idx);
+    }
+    
+    IdxType size()
+    {
+        return _index.size();
+    }
+    
+private:
+    Index& _index;
+    DDOpTrace::Writer& _writer;
+};
+
+#endif
@@ -44,6 +44,9 @@ public:
     
     ValueType randVal() { return _distribution(DDRandomGen::engine()); }
     
+    //the engine is shared by all generators of a ValueType.
+    static void seed(unsigned int seed) { engine().seed(seed); }
+    
 private:
     std::uniform_int_distribution<ValueType> _distribution;
     
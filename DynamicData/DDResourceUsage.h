@@ -0,0 +1,139 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDResourceUsage_h
+#define DynamicData_DDResourceUsage_h
+
+#include <string>
+#include <fstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+/*
+ * Page faults, peak RSS, storage io and the size of the data files of this process. Most of the
+ * cost of the mapped files shows up here instead of in the cpu time.
+ */
+class DDResourceUsage
+{
+public:
+    
+    class Sample
+    {
+    public:
+        Sample() : minorFaults(0), majorFaults(0), maxRssBytes(0), readBytes(0), writeBytes(0), dataBytes(0), dataFiles(0) {}
+        
+        long long minorFaults;
+        long long majorFaults;
+        
+        //high water mark of the process.
+        long long maxRssBytes;
+        
+        //bytes which went to or came from the storage layer, 0 without /proc/self/io.
+        long long readBytes;
+        long long writeBytes;
+        
+        long long dataBytes;
+        long long dataFiles;
+        
+        //counters since earlier, the rss and the data files as of this sample.
+        Sample since(const Sample& earlier) const
+        {
+            Sample delta = *this;
+            
+            delta.minorFaults -= earlier.minorFaults;
+            delta.majorFaults -= earlier.majorFaults;
+            delta.readBytes -= earlier.readBytes;
+            delta.writeBytes -= earlier.writeBytes;
+            
+            return delta;
+        }
+    };
+    
+    static Sample sample(const std::string& dataDir = "data")
+    {
+        Sample sample;
+        
+        struct rusage usage;
+        
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            sample.minorFaults = usage.ru_minflt;
+            sample.majorFaults = usage.ru_majflt;
+            
+#ifdef __APPLE__
+            sample.maxRssBytes = usage.ru_maxrss;
+#else
+            sample.maxRssBytes = usage.ru_maxrss * 1024LL;
+#endif
+        }
+        
+        readIO(sample);
+        readDataDir(dataDir, sample);
+        
+        return sample;
+    }
+    
+private:
+    
+    static void readIO(Sample& sample)
+    {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        long long value;
+        
+        while (io >> key >> value)
+        {
+            if (key == "read_bytes:") sample.readBytes = value;
+            else if (key == "write_bytes:") sample.writeBytes = value;
+        }
+    }
+    
+    static void readDataDir(const std::string& dataDir, Sample& sample)
+    {
+        DIR* dir = opendir(dataDir.c_str());
+        if (!dir) return;
+        
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string path = dataDir + "/" + entry->d_name;
+            struct stat fileStat;
+            
+            if (stat(path.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+            {
+                sample.dataBytes += fileStat.st_size;
+                sample.dataFiles++;
+            }
+        }
+        
+        closedir(dir);
+    }
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDSharedMutex_h
+#define DynamicData_DDSharedMutex_h
+
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+/*
+ * Reader writer lock for DDSharedReadTraits, C++11 has no std::shared_mutex. A reader only does
+ * a compare and swap on the state while no writer holds or waits for the lock. A writer which
+ * waits keeps new readers out until it is done, so the writers are not starved by a read heavy
+ * load. lock and unlock make it usable with std::unique_lock and std::condition_variable_any.
+ */
+class DDSharedMutex
+{
+public:
+    
+    DDSharedMutex() :
+        _state(0)
+    {}
+    
+    DDSharedMutex(const DDSharedMutex&) = delete;
+    const DDSharedMutex& operator=(const DDSharedMutex&) = delete;
+    
+    void lock()
+    {
+        _writerMutex.lock();
+        
+        _state.fetch_or(WriterBit, std::memory_order_acq_rel);
+        
+        //wait for the readers which came in before.
+        if (_state.load(std::memory_order_acquire) != WriterBit)
+        {
+            std::unique_lock<std::mutex> lock(_waitMutex);
+            _cond.wait(lock, [this]() { return _state.load(std::memory_order_acquire) == WriterBit; });
+        }
+    }
+    
+    void unlock()
+    {
+        _state.store(0, std::memory_order_release);
+        
+        {
+            std::unique_lock<std::mutex> lock(_waitMutex);
+        }
+        
+        _cond.notify_all();
+        
+        _writerMutex.unlock();
+    }
+    
+    void lock_shared()
+    {
+        size_t state = _state.load(std::memory_order_relaxed);
+        
+        while (true)
+        {
+            if ((state & WriterBit) == 0)
+            {
+                if (_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed)) return;
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(_waitMutex);
+            _cond.wait(lock, [this]() { return (_state.load(std::memory_order_relaxed) & WriterBit) == 0; });
+            
+            state = _state.load(std::memory_order_relaxed);
+        }
+    }
+    
+    void unlock_shared()
+    {
+        //the last reader wakes up the waiting writer.
+        if (_state.fetch_sub(1, std::memory_order_release) - 1 == WriterBit)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_waitMutex);
+            }
+            
+            _cond.notify_all();
+        }
+    }
+    
+private:
+    static const size_t WriterBit = (size_t)1 << (sizeof(size_t) * 8 - 1);
+    
+    //the reader count and the WriterBit.
+    std::atomic<size_t> _state;
+    
+    //serializes the writers.
+    std::mutex _writerMutex;
+    
+    std::mutex _waitMutex;
+    std::condition_variable _cond;
+};
+
+#endif
@@ -30,13 +30,20 @@
 #ifndef DynamicData_DDSpawn_h
 #define DynamicData_DDSpawn_h
 
+#include <mutex>
+#include <condition_variable>
+
+#include "DDThreadPool.h"
+
+//runs functions asynchronously on the shared DDThreadPool with at most maxThreads of them in flight.
 class DDSpawn
 {
 public:
     
     DDSpawn(size_t maxThreads) :
         _maxThreads(maxThreads),
-        _threadCount(0)
+        _threadCount(0),
+        _threadPool(DDThreadPool::SHARED())
     {
         
     }
@@ -53,11 +60,15 @@ public:
     {
         waitUntilThreadCountSmallerThen(_maxThreads);
         
-        std::unique_lock<std::mutex> lock(_mutex);
-        _threadCount++;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _threadCount++;
+        }
         
-        std::thread t(&DDSpawn::asyncRun, this, func);
-        t.detach();
+        _threadPool->submit([this, func]()
+        {
+            asyncRun(func);
+        });
     }
     
 private:
@@ -65,6 +76,7 @@ private:
     size_t _maxThreads;
     int _threadCount;
     std::condition_variable _condVar;
+    DDThreadPool* _threadPool;
     
     void asyncRun(std::function<void ()> func)
     {
@@ -0,0 +1,338 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDThreadPool_h
+#define DynamicData_DDThreadPool_h
+
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "DDUtils.h"
+
+/*
+ * Persistent work stealing pool shared by the library.
+ *
+ * Every worker owns a deque. A worker pops its own tasks from the back (lifo, cache friendly)
+ * and steals from the front of the other deques (fifo, the biggest pieces of a split range).
+ *
+ * parallelFor splits its range lazily: a range task only halves its range while it is bigger
+ * than the grain and the loop has less tasks in flight than it may use threads, so the number of
+ * chunks adapts to how many workers are actually idle. The loop body is a template parameter and
+ * is inlined in the inner loop, only the chunks are type erased.
+ */
+class DDThreadPool
+{
+public:
+    
+    typedef std::function<void ()> Task;
+    
+    DDThreadPool(size_t numOfWorkers = 0) :
+        _queued(0),
+        _nextWorker(0),
+        _stop(false)
+    {
+        if (numOfWorkers == 0) numOfWorkers = std::max(2u, std::thread::hardware_concurrency());
+        
+        for (size_t i=0; i<numOfWorkers; i++)
+        {
+            _workers.push_back(DDUtils::make_unique<Worker>());
+        }
+        
+        //the ids are only written here, before any task can be submitted.
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        
+        for (size_t i=0; i<numOfWorkers; i++)
+        {
+            _threads.push_back(std::thread(&DDThreadPool::workerLoop, this, i));
+            _threadIds.push_back(_threads.back().get_id());
+        }
+    }
+    
+    ~DDThreadPool()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _stop = true;
+        }
+        
+        _sleepCond.notify_all();
+        
+        for (auto itr = _threads.begin(); itr != _threads.end(); itr++)
+        {
+            itr->join();
+        }
+    }
+    
+    DDThreadPool(const DDThreadPool&) = delete;
+    const DDThreadPool& operator=(const DDThreadPool&) = delete;
+    
+    static DDThreadPool* SHARED()
+    {
+        return DDUtils::SHARED<DDThreadPool>();
+    }
+    
+    size_t numOfWorkers() const
+    {
+        return _workers.size();
+    }
+    
+    //tasks submitted from a worker go to its own deque, all others are distributed round robin.
+    void submit(Task task)
+    {
+        size_t workerIdx;
+        
+        if (!currentWorker(workerIdx))
+        {
+            workerIdx = _nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+        }
+        
+        //count the task first, a worker which sees the count before the task keeps polling.
+        {
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _queued++;
+        }
+        
+        {
+            Worker& worker = *_workers[workerIdx];
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.deque.push_back(std::move(task));
+        }
+        
+        _sleepCond.notify_one();
+    }
+    
+    //calls body(idx) for every idx in [begin, end) and returns when all calls are done.
+    //the calling thread works on the loop too.
+    template<typename IdxType, class Body>
+    void parallelFor(IdxType begin, IdxType end, IdxType grain, const Body& body, size_t maxParallelism = 0)
+    {
+        if (end <= begin) return;
+        
+        if (grain < 1) grain = 1;
+        if (maxParallelism == 0 || maxParallelism > _workers.size() + 1) maxParallelism = _workers.size() + 1;
+        
+        //small loops are not worth a task.
+        if (end - begin <= grain || maxParallelism == 1)
+        {
+            for (IdxType idx = begin; idx < end; idx++) body(idx);
+            return;
+        }
+        
+        std::shared_ptr<LoopState<IdxType>> state = std::make_shared<LoopState<IdxType>>(end - begin, maxParallelism);
+        
+        state->tasks++;
+        runRange(state, begin, end, grain, body);
+        
+        //help until the last range is done.
+        while (state->remaining.load(std::memory_order_acquire) > 0)
+        {
+            Task task;
+            size_t workerIdx;
+            
+            if (!currentWorker(workerIdx)) workerIdx = 0;
+            
+            if (popTask(workerIdx, task))
+            {
+                task();
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                
+                if (state->remaining > 0)
+                {
+                    state->cond.wait_for(lock, std::chrono::microseconds(200));
+                }
+            }
+        }
+    }
+    
+private:
+    
+    class Worker
+    {
+    public:
+        std::mutex mutex;
+        std::deque<Task> deque;
+    };
+    
+    template<typename IdxType>
+    class LoopState
+    {
+    public:
+        LoopState(IdxType count, size_t maxTasksIN) :
+            remaining(count),
+            tasks(0),
+            maxTasks(maxTasksIN)
+        {}
+        
+        std::atomic<IdxType> remaining;
+        std::atomic<size_t> tasks;
+        size_t maxTasks;
+        
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+    
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    std::vector<std::thread::id> _threadIds;
+    
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCond;
+    size_t _queued;
+    
+    std::atomic<size_t> _nextWorker;
+    bool _stop;
+    
+    template<typename IdxType, class Body>
+    void runRange(std::shared_ptr<LoopState<IdxType>> state, IdxType begin, IdxType end, IdxType grain, const Body& body)
+    {
+        //split off the upper half as long as there are threads left to work on it.
+        while (end - begin > grain && state->tasks.load(std::memory_order_relaxed) < state->maxTasks)
+        {
+            IdxType mid = begin + (end - begin) / 2;
+            
+            state->tasks++;
+            
+            const Body* bodyPtr = &body;
+            submit([this, state, mid, end, grain, bodyPtr]()
+            {
+                runRange(state, mid, end, grain, *bodyPtr);
+            });
+            
+            end = mid;
+        }
+        
+        for (IdxType idx = begin; idx < end; idx++)
+        {
+            body(idx);
+        }
+        
+        state->tasks--;
+        
+        if (state->remaining.fetch_sub(end - begin, std::memory_order_acq_rel) == end - begin)
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cond.notify_all();
+        }
+    }
+    
+    bool currentWorker(size_t& workerIdx)
+    {
+        std::thread::id threadId = std::this_thread::get_id();
+        
+        for (size_t i=0; i<_threadIds.size(); i++)
+        {
+            if (_threadIds[i] == threadId)
+            {
+                workerIdx = i;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    bool popTask(size_t workerIdx, Task& task)
+    {
+        bool found = false;
+        
+        //own deque first.
+        {
+            Worker& worker = *_workers[workerIdx];
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            
+            if (!worker.deque.empty())
+            {
+                task = std::move(worker.deque.back());
+                worker.deque.pop_back();
+                found = true;
+            }
+        }
+        
+        //steal.
+        for (size_t i=1; !found && i<_workers.size(); i++)
+        {
+            Worker& victim = *_workers[(workerIdx + i) % _workers.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+            
+            if (!victim.deque.empty())
+            {
+                task = std::move(victim.deque.front());
+                victim.deque.pop_front();
+                found = true;
+            }
+        }
+        
+        if (found)
+        {
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _queued--;
+        }
+        
+        return found;
+    }
+    
+    void workerLoop(size_t workerIdx)
+    {
+        {
+            //wait until the constructor has registered all thread ids.
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+        }
+        
+        while (true)
+        {
+            Task task;
+            
+            if (popTask(workerIdx, task))
+            {
+                task();
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                
+                if (_stop) break;
+                if (_queued == 0) _sleepCond.wait(lock);
+                if (_stop) break;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDTraceEvents_h
+#define DynamicData_DDTraceEvents_h
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "DDUtils.h"
+
+/*
+ * Spans in the Chrome trace event format, e.g. for chrome://tracing or Perfetto. The spans are
+ * compiled in with DD_TRACING and recorded between start and stop, which writes the file.
+ *
+ *   DDTraceEvents::SHARED()->start("dd.trace.json");
+ *   ...
+ *   DDTraceEvents::SHARED()->stop();
+ */
+class DDTraceEvents
+{
+public:
+    
+    typedef std::chrono::steady_clock clock;
+    
+    DDTraceEvents() :
+        _enabled(false),
+        _dropped(0)
+    {}
+    
+    DDTraceEvents(const DDTraceEvents&) = delete;
+    const DDTraceEvents& operator=(const DDTraceEvents&) = delete;
+    
+    static DDTraceEvents* SHARED()
+    {
+        return DDUtils::SHARED<DDTraceEvents>();
+    }
+    
+    bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+    
+    void start(const std::string& path)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        _path = path;
+        _events.clear();
+        _dropped = 0;
+        _origin = clock::now();
+        
+        _enabled = true;
+    }
+    
+    //writes the recorded spans to the file of start.
+    bool stop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        if (!_enabled) return false;
+        _enabled = false;
+        
+        std::ofstream file(_path.c_str(), std::ios::trunc);
+        
+        if (!file)
+        {
+            std::cout << "DDTraceEvents: error opening " << _path << std::endl;
+            return false;
+        }
+        
+        file << "{\"traceEvents\": [";
+        
+        for (size_t i=0; i<_events.size(); i++)
+        {
+            const Event& event = _events[i];
+            
+            file << (i > 0 ? ",\n" : "\n");
+            file << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\"";
+            file << ", \"ts\": " << micros(event.start - _origin) << ", \"dur\": " << micros(event.end - event.start);
+            file << ", \"pid\": 1, \"tid\": " << event.thread << "}";
+        }
+        
+        file << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped\": " << _dropped << "}}" << std::endl;
+        
+        _events.clear();
+        
+        return (bool)file;
+    }
+    
+    //category and name have to be string literals.
+    void complete(const char* category, const char* name, clock::time_point start, clock::time_point end)
+    {
+        if (!enabled()) return;
+        
+        std::unique_lock<std::mutex> lock(_mutex);
+        
+        if (_events.size() >= MaxEvents)
+        {
+            _dropped++;
+            return;
+        }
+        
+        Event event;
+        event.category = category;
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        event.thread = threadIdx();
+        
+        _events.push_back(event);
+    }
+    
+private:
+    
+    //bounds the memory of a forgotten trace.
+    static const size_t MaxEvents = 1 << 22;
+    
+    class Event
+    {
+    public:
+        const char* category;
+        const char* name;
+        clock::time_point start;
+        clock::time_point end;
+        size_t thread;
+    };
+    
+    std::mutex _mutex;
+    std::atomic<bool> _enabled;
+    std::string _path;
+    std::vector<Event> _events;
+    size_t _dropped;
+    clock::time_point _origin;
+    std::map<std::thread::id, size_t> _threads;
+    
+    //small thread ids in the order of the first event, called with _mutex held.
+    size_t threadIdx()
+    {
+        auto inserted = _threads.insert(std::make_pair(std::this_thread::get_id(), _threads.size() + 1));
+        return inserted.first->second;
+    }
+    
+    static double micros(clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 1000.0;
+    }
+};
+
+//records its lifetime as a span.
+class DDTraceSpan
+{
+public:
+    
+    DDTraceSpan(const char* category, const char* name) :
+        _category(category),
+        _name(name),
+        _enabled(DDTraceEvents::SHARED()->enabled())
+    {
+        if (_enabled) _start = DDTraceEvents::clock::now();
+    }
+    
+    ~DDTraceSpan()
+    {
+        if (_enabled) DDTraceEvents::SHARED()->complete(_category, _name, _start, DDTraceEvents::clock::now());
+    }
+    
+    DDTraceSpan(const DDTraceSpan&) = delete;
+    const DDTraceSpan& operator=(const DDTraceSpan&) = delete;
+    
+private:
+    const char* _category;
+    const char* _name;
+    bool _enabled;
+    DDTraceEvents::clock::time_point _start;
+};
+
+#define DD_TRACE_CONCAT2(a, b) a##b
+#define DD_TRACE_CONCAT(a, b) DD_TRACE_CONCAT2(a, b)
+
+#ifdef DD_TRACING
+#define DD_TRACE_SPAN(category, name) DDTraceSpan DD_TRACE_CONCAT(_ddTraceSpan, __LINE__)(category, name)
+#define DD_TRACE_COMPLETE(category, name, start, end) DDTraceEvents::SHARED()->complete(category, name, start, end)
+#else
+#define DD_TRACE_SPAN(category, name)
+#define DD_TRACE_COMPLETE(category, name, start, end)
+#endif
+
+#endif
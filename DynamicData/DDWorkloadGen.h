@@ -0,0 +1,274 @@
+/*
+
+    Copyright (c) 2013, Clever & Son
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without modification, are
+    permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice, this list of
+    conditions and the following disclaimer.
+    Redistributions in binary form must reproduce the above copyright notice, this list of
+    conditions and the following disclaimer in the documentation and/or other materials
+    provided with the distribution.
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+    CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+    NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+    ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DynamicData_DDWorkloadGen_h
+#define DynamicData_DDWorkloadGen_h
+
+#include <cmath>
+#include <string>
+#include <cstdint>
+
+//xorshift64* seeded with splitmix64; small and fast, one per thread.
+class DDFastRandom
+{
+public:
+    
+    DDFastRandom(uint64_t seed)
+    {
+        _state = splitMix(seed);
+        if (_state == 0) _state = 0x9E3779B97F4A7C15ULL;
+    }
+    
+    uint64_t next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        
+        return _state * 0x2545F4914F6CDD1DULL;
+    }
+    
+    //uniform in [0, 1).
+    double nextDouble()
+    {
+        return (double)(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    
+    //uniform in [0, range).
+    uint64_t nextInRange(uint64_t range)
+    {
+        return range > 0 ? next() % range : 0;
+    }
+    
+    //independent seeds for the threads of one run.
+    static uint64_t seedFor(uint64_t seed, uint64_t threadIdx)
+    {
+        return splitMix(seed ^ splitMix(threadIdx + 1));
+    }
+    
+private:
+    uint64_t _state;
+    
+    static uint64_t splitMix(uint64_t value)
+    {
+        value += 0x9E3779B97F4A7C15ULL;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+        
+        return value ^ (value >> 31);
+    }
+};
+
+/*
+ * Positions and operations of a benchmark workload.
+ *
+ * Uniform     every position alike.
+ * Zipfian     position 0 is the hottest, e.g. the top of a feed.
+ * Hotspot     hotspotOpFraction of the positions come from a region of hotspotFraction
+ *             of the index which starts at hotspotStart.
+ * Latest      zipfian from the end, e.g. the tail of a log.
+ * Sequential  counts up and wraps; a pure insert workload appends.
+ *
+ * The range is passed per call since the index grows and shrinks: size for reads and
+ * deletes, size + 1 for inserts. Not thread safe, every thread owns a generator.
+ */
+class DDWorkloadGen
+{
+public:
+    
+    enum Distribution
+    {
+        Uniform,
+        Zipfian,
+        Hotspot,
+        Latest,
+        Sequential
+    };
+    
+    enum Op
+    {
+        Read,
+        Insert,
+        Delete
+    };
+    
+    class Config
+    {
+    public:
+        Config() :
+            distribution(Uniform),
+            zipfTheta(0.99),
+            hotspotFraction(0.1),
+            hotspotOpFraction(0.9),
+            hotspotStart(0),
+            readPercent(100),
+            insertPercent(0)
+        {}
+        
+        Distribution distribution;
+        
+        double zipfTheta;
+        
+        double hotspotFraction;
+        double hotspotOpFraction;
+        double hotspotStart;
+        
+        //the remaining percent are deletes.
+        unsigned int readPercent;
+        unsigned int insertPercent;
+    };
+    
+    DDWorkloadGen(const Config& config, uint64_t seed) :
+        _config(config),
+        _random(seed),
+        _counter(0),
+        _zipfItems(0),
+        _zetaN(0)
+    {
+        _zipfAlpha = 1.0 / (1.0 - _config.zipfTheta);
+        _zeta2 = zeta(0, 2, 0);
+    }
+    
+    //position in [0, range).
+    uint64_t position(uint64_t range)
+    {
+        if (range <= 1) return 0;
+        
+        switch (_config.distribution)
+        {
+            case Zipfian: return zipfian(range);
+            case Hotspot: return hotspot(range);
+            case Latest: return range - 1 - zipfian(range);
+            case Sequential: return _counter++ % range;
+            default: return _random.nextInRange(range);
+        }
+    }
+    
+    Op op()
+    {
+        uint64_t percent = _random.nextInRange(100);
+        
+        if (percent < _config.readPercent) return Read;
+        if (percent < _config.readPercent + _config.insertPercent) return Insert;
+        
+        return Delete;
+    }
+    
+    static bool parseDistribution(const std::string& name, Distribution& distribution)
+    {
+        static const char* names[] = {"uniform", "zipfian", "hotspot", "latest", "sequential"};
+        
+        for (int i=0; i<5; i++)
+        {
+            if (name == names[i])
+            {
+                distribution = (Distribution)i;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    static const char* distributionName(Distribution distribution)
+    {
+        static const char* names[] = {"uniform", "zipfian", "hotspot", "latest", "sequential"};
+        
+        return names[distribution];
+    }
+    
+private:
+    Config _config;
+    DDFastRandom _random;
+    uint64_t _counter;
+    
+    //zipfian state (Gray et al., "Quickly generating billion-record synthetic databases").
+    uint64_t _zipfItems;
+    double _zetaN;
+    double _zeta2;
+    double _zipfAlpha;
+    double _zipfEta;
+    
+    double zeta(uint64_t from, uint64_t to, double sum)
+    {
+        for (uint64_t i = from; i < to; i++) sum += 1.0 / std::pow((double)(i + 1), _config.zipfTheta);
+        
+        return sum;
+    }
+    
+    uint64_t zipfian(uint64_t range)
+    {
+        //grows incrementally, starts over if the index shrank a lot.
+        if (range > _zipfItems || range < _zipfItems / 2)
+        {
+            if (range > _zipfItems) _zetaN = zeta(_zipfItems, range, _zetaN);
+            else _zetaN = zeta(0, range, 0);
+            
+            _zipfItems = range;
+            _zipfEta = (1.0 - std::pow(2.0 / (double)_zipfItems, 1.0 - _config.zipfTheta)) / (1.0 - _zeta2 / _zetaN);
+        }
+        
+        while (true)
+        {
+            double u = _random.nextDouble();
+            double uz = u * _zetaN;
+            
+            uint64_t rank;
+            
+            if (uz < 1.0) rank = 0;
+            else if (uz < 1.0 + std::pow(0.5, _config.zipfTheta)) rank = 1;
+            else rank = (uint64_t)((double)_zipfItems * std::pow(_zipfEta * u - _zipfEta + 1.0, _zipfAlpha));
+            
+            //ranks beyond a shrunken range are drawn again.
+            if (rank < range) return rank;
+        }
+    }
+    
+    uint64_t hotspot(uint64_t range)
+    {
+        uint64_t hotSize = (uint64_t)((double)range * _config.hotspotFraction);
+        if (hotSize == 0) hotSize = 1;
+        if (hotSize > range) hotSize = range;
+        
+        uint64_t hotStart = (uint64_t)((double)range * _config.hotspotStart);
+        if (hotStart + hotSize > range) hotStart = range - hotSize;
+        
+        if (_random.nextDouble() < _config.hotspotOpFraction || hotSize == range)
+        {
+            return hotStart + _random.nextInRange(hotSize);
+        }
+        
+        //a cold position, the hot region is skipped.
+        uint64_t cold = _random.nextInRange(range - hotSize);
+        
+        return cold < hotStart ? cold : cold + hotSize;
+    }
+};
+
+#endif
@@ -33,9 +33,13 @@
 
 #include <unistd.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <thread>
 
 #include "DDUtils.h"
 #include "DDFileHandle.h"
+#include "DDTraceEvents.h"
 
 template<typename IdxType, class Type, class UserDataHeader>
 class MMapWrapper
@@ -57,7 +61,10 @@ public:
         _triplePaddingSize(paddingSize * 3),
         _headerSize(sizeof(HeaderData) + sizeof(UserDataHeader)),
         _isMapped(false),
-        _userDataHeaderPtr(0)
+        _userDataHeaderPtr(0),
+        _fileGrowths(0),
+        _remapping(false),
+        _pins(0)
     {
         _fileDesc = open(_ddFileHandle.path().c_str(), O_RDWR | O_CREAT, (mode_t)0600);
         off_t rawFileSize = _ddFileHandle.fileSize();
@@ -106,6 +113,39 @@ public:
         return _map[idx];
     }
     
+    /*
+     * Keeps the file mapped in place while a value is read without the lock of the owner. A remap
+     * waits until the pinned reads are done, reads which want to start meanwhile wait for the remap.
+     */
+    class ReadPin
+    {
+    public:
+        ReadPin(MMapWrapper& mmapWrapper) :
+            _mmapWrapper(mmapWrapper)
+        {
+            _mmapWrapper.pin();
+        }
+        
+        ~ReadPin()
+        {
+            _mmapWrapper.unpin();
+        }
+        
+        ReadPin(const ReadPin&) = delete;
+        const ReadPin& operator=(const ReadPin&) = delete;
+        
+    private:
+        MMapWrapper& _mmapWrapper;
+    };
+    
+    //called with a ReadPin. idx was valid when the owner resolved it, the size may have changed since.
+    Type getPinnedVal(IdxType idx)
+    {
+        assert(idx < _fileSize);
+        
+        return _map[idx];
+    }
+    
     void persistVal(IdxType idx, Type value)
     {
         assert(idx < _fileSize);
@@ -139,6 +179,7 @@ public:
     {
         _mapSize = size;
         remapIfNeeded2();
+        writeMapSizeToFile();
     }
     
     IdxType size()
@@ -151,6 +192,35 @@ public:
         return _fileSize;
     }
     
+    //number of times the file has been enlarged, readable from any thread.
+    size_t fileGrowths()
+    {
+        return _fileGrowths.load(std::memory_order_relaxed);
+    }
+    
+    //writes the dirty pages of the values in [fromIdx, toIdx) back to the file.
+    void sync(IdxType fromIdx, IdxType toIdx)
+    {
+        DD_TRACE_SPAN("MMapWrapper", "sync");
+        
+        if (toIdx > _fileSize) toIdx = _fileSize;
+        
+        if (_isMapped && fromIdx < toIdx)
+        {
+            size_t pageSize = sysconf(_SC_PAGESIZE);
+            
+            size_t begin = _headerSize + (size_t)fromIdx * sizeof(Type);
+            size_t end = _headerSize + (size_t)toIdx * sizeof(Type);
+            
+            begin -= begin % pageSize;
+            
+            if (msync(_rawMap + begin, end - begin, MS_SYNC) == -1)
+            {
+                std::cout << "MMapWrapper: error syncing file " << _mapSize << std::endl;
+            }
+        }
+    }
+    
     UserDataHeader getUserDataHeader()
     {
         assert(_userDataHeaderPtr);
@@ -185,6 +255,42 @@ private:
     
     bool _isMapped;
     
+    std::atomic<size_t> _fileGrowths;
+    
+    //see ReadPin.
+    std::atomic<bool> _remapping;
+    std::atomic<int> _pins;
+    
+    void pin()
+    {
+        while (true)
+        {
+            while (_remapping.load()) std::this_thread::yield();
+            
+            _pins.fetch_add(1);
+            if (!_remapping.load()) return;
+            
+            _pins.fetch_sub(1);
+        }
+    }
+    
+    void unpin()
+    {
+        _pins.fetch_sub(1);
+    }
+    
+    void beginRemap()
+    {
+        _remapping.store(true);
+        
+        while (_pins.load() > 0) std::this_thread::yield();
+    }
+    
+    void endRemap()
+    {
+        _remapping.store(false);
+    }
+    
     void unmap()
     {
         if(_isMapped)
@@ -230,23 +336,39 @@ private:
     //TODO rename.
     void relResizeFile(int delta)
     {
+        DD_TRACE_SPAN("MMapWrapper", "resize file");
+        
+        beginRemap();
+        
         unmap();
         if (delta > 0) _fileSize += (delta * _paddingSize);
         else _fileSize -= (-delta * _paddingSize);
         
+        if (delta > 0) _fileGrowths.fetch_add(1, std::memory_order_relaxed);
+        
         ftruncate(_fileDesc, _fileSize * sizeof(Type) + _headerSize);
         
         map();
+        
+        endRemap();
     }
     
     void resizeFile(IdxType size)
     {
+        DD_TRACE_SPAN("MMapWrapper", "resize file");
+        
+        beginRemap();
+        
         unmap();
         
+        if (size + 2 * _paddingSize > _fileSize) _fileGrowths.fetch_add(1, std::memory_order_relaxed);
+        
         _fileSize = size + 2 * _paddingSize;
         ftruncate(_fileDesc, _fileSize * sizeof(Type) + _headerSize);
         
         map();
+        
+        endRemap();
     }
     
     void writeMapSizeToFile()
@@ -31,6 +31,8 @@
 #define DynamicData_Tests_h
 
 #include <set>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "MMapWrapper.h"
 #include "DDIndex.h"
 #include "DDLoopReduce.h"
@@ -75,6 +77,20 @@ public:
         
         static const IdxType RandomDeleteWrites = 9000;
         
+        static const size_t LatencySampleRate = 1;
+        
+        static const size_t ConcurrentOpsPerThread = 2000;
+        static const size_t ConcurrentMaxThreads = 8;
+        static const size_t ConcurrentWriterPercent = 25;
+        
+        static const size_t MergeInsertPercent = 50;
+        static const size_t MergeWriteRate = 5000;
+        static const size_t MergeWriteSeconds = 2;
+        
+        static const size_t BaselineMaxSize = 100000;
+        static const size_t BaselineOps = 10000;
+        static const size_t BaselineSeconds = 1;
+        
         class IndexObj
         {
         public:
@@ -109,7 +125,7 @@ public:
     
     static void testAssertConfig()
     {
-        system("rm -r data");
+        system("rm -rf data; mkdir -p data");
         
         DDBenchmarkRunner::runBenchmarks<RunnerConfigAssert>();
     }
@@ -135,6 +151,21 @@ public:
     
         static const IdxType RandomDeleteWrites = 50000;
         
+        //timing every op costs more than 5% on the reads.
+        static const size_t LatencySampleRate = 16;
+        
+        static const size_t ConcurrentOpsPerThread = 100000;
+        static const size_t ConcurrentMaxThreads = 64;
+        static const size_t ConcurrentWriterPercent = 25;
+        
+        static const size_t MergeInsertPercent = 50;
+        static const size_t MergeWriteRate = 100000;
+        static const size_t MergeWriteSeconds = 10;
+        
+        static const size_t BaselineMaxSize = 1000000;
+        static const size_t BaselineOps = 100000;
+        static const size_t BaselineSeconds = 5;
+        
         class IndexObj
         {
         public:
@@ -169,10 +200,417 @@ public:
     
     static void testBenchmarks()
     {
-        system("rm -r data");
+        system("rm -rf data; mkdir -p data");
         
         DDBenchmarkRunner::runBenchmarks<RunnerConfigBenchMark>();
     }
+    
+    
+    /*
+     * Random inserts, deletes and gets on a DDIndex and a DDImplicitTreap. The index grows to
+     * maxSize and stays around it, every checkInterval ops all elements are compared, every
+     * second time after a flush so the merged state is checked as well. The large indexes are
+     * checked here, RunnerConfigAssert keeps the assert benchmarks small.
+     */
+    static void testDifferentialStress(size_t operations = 20000000, size_t maxSize = 1000000, size_t checkInterval = 2000000, uint64_t seed = 1)
+    {
+        typedef RunnerConfigAssert::IndexObj IndexObj;
+        
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, IndexObj> index(2, 0, 1, 2);
+        DDImplicitTreap<IndexObj> model;
+        
+        //the reclustered maps are checked as well.
+        index.setReclustering(0.2, (unsigned int)(maxSize / 8));
+        
+        differential(index, model, []() { return IndexObj::rand(); }, operations, maxSize, checkInterval, seed);
+        
+        index.unpersist();
+    }
+    
+    //the differential test on DDDirectValueTraits, the values live in the position maps.
+    static void testDirectValues(size_t operations = 400000, size_t maxSize = 40000, size_t checkInterval = 50000, uint64_t seed = 2)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, unsigned long, DDDirectValueTraits<unsigned long>> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        
+        unsigned long nextValue = 0;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, checkInterval, seed);
+        
+        index.unpersist();
+    }
+    
+    /*
+     * The differential test on DDStagedValueTraits, then rounds of overwrites without a merge. The
+     * staged values are read before and after the flush, and the merges reclaim the overwritten
+     * ones so the files stop growing.
+     */
+    static void testStagedValues(size_t operations = 200000, size_t maxSize = 20000, size_t checkInterval = 25000, uint64_t seed = 4)
+    {
+        typedef RunnerConfigAssert::IndexObj IndexObj;
+        
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, IndexObj, DDStagedValueTraits<IndexObj>> index(2, 0, 1, 2);
+        DDImplicitTreap<IndexObj> model;
+        
+        differential(index, model, []() { return IndexObj::rand(); }, operations, maxSize, checkInterval, seed);
+        
+        index.setAutoMerge(false);
+        
+        DDFastRandom random(seed);
+        size_t storageBytes = 0;
+        
+        for (size_t round=0; round<3; round++)
+        {
+            for (size_t i=0; i<maxSize; i++)
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(model.size());
+                IndexObj value = IndexObj::rand();
+                
+                model.erase(idx);
+                model.insert(idx, value);
+                
+                index.deleteIdx(idx);
+                index.insertIdx(idx, value);
+            }
+            
+            check(index, model);
+            index.flush();
+            check(index, model);
+            
+            assert(round == 0 || index.storageBytes() == storageBytes);
+            storageBytes = index.storageBytes();
+        }
+        
+        index.unpersist();
+    }
+    
+    //the differential test with setLevels, the active field is folded into the spilled run between the merges.
+    static void testLevels(size_t operations = 400000, size_t maxSize = 40000, size_t checkInterval = 50000, uint64_t seed = 6)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, unsigned long> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        
+        index.setLevels(2000, 4);
+        
+        unsigned long nextValue = 0;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, checkInterval, seed);
+        
+        DDIndexMetrics::Snapshot snapshot = index.metrics();
+        
+        //the folds and at least the merges of the flushes.
+        assert(snapshot.counter(DDIndexMetrics::Spills) > 0);
+        assert(snapshot.counter(DDIndexMetrics::Merges) >= operations / checkInterval / 2);
+        
+        index.unpersist();
+    }
+    
+    /*
+     * The differential test with setPipeline while the background merges run. The merges are
+     * throttled so the writes overlap their core writes and hand off batches.
+     */
+    static void testPipeline(size_t operations = 400000, size_t maxSize = 40000, size_t checkInterval = 50000, uint64_t seed = 7)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDMergeThrottle::Config config = DDMergeThrottle::SHARED()->config();
+        DDMergeThrottle::Config throttled = config;
+        throttled.bytesPerSec = 2 << 20;
+        throttled.burstBytes = 4096;
+        DDMergeThrottle::SHARED()->setConfig(throttled);
+        
+        DDIndex<unsigned int, unsigned long> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        
+        index.setPipeline(3, 500);
+        
+        unsigned long nextValue = 0;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, checkInterval, seed);
+        
+        DDMergeThrottle::SHARED()->setConfig(config);
+        
+        assert(index.metrics().counter(DDIndexMetrics::Handoffs) > 0);
+        
+        index.unpersist();
+    }
+    
+    //the differential test with a small field budget, the gets read the spilled runs.
+    static void testSpill(size_t operations = 400000, size_t maxSize = 40000, size_t checkInterval = 50000, uint64_t seed = 5)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, unsigned long> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        
+        index.setFieldBudget(64 << 10);
+        
+        unsigned long nextValue = 0;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, checkInterval, seed);
+        
+        DDIndexMetrics::Snapshot snapshot = index.metrics();
+        
+        assert(snapshot.counter(DDIndexMetrics::Spills) > 0);
+        assert(snapshot.counter(DDIndexMetrics::GetsFromSpill) > 0);
+        
+        index.unpersist();
+    }
+    
+    //the differential test with setReclustering, the merges rewrite regions of the value file in position order.
+    static void testReclustering(size_t operations = 400000, size_t maxSize = 40000, size_t checkInterval = 50000, uint64_t seed = 8)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, unsigned long> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        
+        index.setReclustering(0.1, 5000);
+        
+        unsigned long nextValue = 0;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, checkInterval, seed);
+        
+        assert(index.metrics().counter(DDIndexMetrics::Reclusters) > 0);
+        
+        //a full recluster leaves every merged value right after the one of the previous position.
+        index.recluster();
+        check(index, model);
+        assert(index.fragmentation() == 0);
+        
+        index.unpersist();
+    }
+    
+    /*
+     * Reader threads compare the gets of a DDSharedReadTraits index with the model while the test
+     * thread writes and the background merges run. The readers share the model lock, so their
+     * gets overlap each other and the merges.
+     */
+    static void testSharedReads(size_t operations = 100000, size_t maxSize = 20000, size_t numOfReaders = 3, uint64_t seed = 8)
+    {
+        system("rm -rf data; mkdir -p data");
+        
+        DDIndex<unsigned int, unsigned long, DDSharedReadTraits<unsigned long>> index(2, 0, 1, 2);
+        DDImplicitTreap<unsigned long> model;
+        DDSharedMutex modelMutex;
+        
+        std::atomic<bool> stop(false);
+        std::atomic<size_t> reads(0);
+        std::atomic<size_t> mismatches(0);
+        
+        std::vector<std::thread> readers;
+        
+        for (size_t t=0; t<numOfReaders; t++)
+        {
+            readers.push_back(std::thread([&index, &model, &modelMutex, &stop, &reads, &mismatches, seed, t]()
+            {
+                DDFastRandom random(DDFastRandom::seedFor(seed, t + 1));
+                
+                while (!stop)
+                {
+                    modelMutex.lock_shared();
+                    
+                    size_t size = model.size();
+                    
+                    if (size > 0)
+                    {
+                        unsigned int idx = (unsigned int)random.nextInRange(size);
+                        
+                        if (!(index.get(idx) == model.get(idx))) mismatches++;
+                        reads++;
+                    }
+                    
+                    modelMutex.unlock_shared();
+                }
+            }));
+        }
+        
+        DDFastRandom random(seed);
+        unsigned long nextValue = 0;
+        
+        for (size_t i=0; i<operations; i++)
+        {
+            std::unique_lock<DDSharedMutex> lock(modelMutex);
+            
+            size_t size = model.size();
+            
+            if (size == 0 || (size < maxSize && random.nextInRange(100) < 60))
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size + 1);
+                
+                model.insert(idx, nextValue);
+                index.insertIdx(idx, nextValue++);
+            }
+            else
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size);
+                
+                model.erase(idx);
+                index.deleteIdx(idx);
+            }
+        }
+        
+        stop = true;
+        
+        for (auto itr = readers.begin(); itr != readers.end(); itr++) itr->join();
+        
+        assert(reads > 0);
+        assert(mismatches == 0);
+        
+        index.flush();
+        check(index, model);
+        
+        index.unpersist();
+    }
+    
+    /*
+     * A child process merges a JournaledMap index and exits right after the journal of its second
+     * merge became durable, before it is applied. The reopened index has to replay the journal and
+     * match the model.
+     */
+    static void testJournalReplay(size_t operations = 100000, size_t maxSize = 20000, uint64_t seed = 3)
+    {
+        typedef DDIndex<unsigned int, unsigned long, DDJournaledMapTraits<unsigned long>> Index;
+        
+        system("rm -rf data; mkdir -p data");
+        
+        DDFastRandom random(seed);
+        DDImplicitTreap<unsigned long> model;
+        
+        //the operations of both merges, a delete has the value 0.
+        std::vector<std::pair<unsigned int, unsigned long>> ops;
+        
+        for (size_t i=0; i<2*operations; i++)
+        {
+            size_t size = model.size();
+            
+            if (size == 0 || (size < maxSize && random.nextInRange(100) < 60))
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size + 1);
+                
+                model.insert(idx, i + 1);
+                ops.push_back(std::make_pair(idx, i + 1));
+            }
+            else
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size);
+                
+                model.erase(idx);
+                ops.push_back(std::make_pair(idx, 0));
+            }
+        }
+        
+        pid_t pid = fork();
+        
+        if (pid == 0)
+        {
+            Index index(2, 0, 1, 2);
+            index.setAutoMerge(false);
+            
+            for (size_t i=0; i<ops.size(); i++)
+            {
+                if (ops[i].second) index.insertIdx(ops[i].first, ops[i].second);
+                else index.deleteIdx(ops[i].first);
+                
+                if (i + 1 == operations) index.flush();
+            }
+            
+            index.setCommitHook([]() { _exit(0); });
+            index.flush();
+            
+            //the hook was not called.
+            _exit(1);
+        }
+        
+        int status = 0;
+        waitpid(pid, &status, 0);
+        
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cout << "Tests: error the merge did not stop after the journal commit" << std::endl;
+            exit(1);
+        }
+        
+        Index index(2, 0, 1, 2);
+        check(index, model);
+        
+        //the replayed index merges on.
+        unsigned long nextValue = 2*operations + 1;
+        
+        differential(index, model, [&nextValue]() { return nextValue++; }, operations, maxSize, operations / 2, seed);
+        
+        index.unpersist();
+    }
+    
+    //the operations of the differential tests, newValue returns the value of the next insert.
+    template<class Index, typename Value, class NewValue>
+    static void differential(Index& index, DDImplicitTreap<Value>& model, NewValue newValue, size_t operations, size_t maxSize, size_t checkInterval, uint64_t seed)
+    {
+        DDFastRandom random(seed);
+        
+        for (size_t i=1; i<=operations; i++)
+        {
+            size_t size = model.size();
+            uint64_t percent = random.nextInRange(100);
+            
+            //50% gets, the rest grows the index up to maxSize.
+            uint64_t insertPercent = size < maxSize ? 30 : 25;
+            
+            if (size == 0 || percent < insertPercent)
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size + 1);
+                Value value = newValue();
+                
+                model.insert(idx, value);
+                index.insertIdx(idx, value);
+            }
+            else if (percent < 50)
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size);
+                
+                model.erase(idx);
+                index.deleteIdx(idx);
+            }
+            else
+            {
+                unsigned int idx = (unsigned int)random.nextInRange(size);
+                
+                assert(index.get(idx) == model.get(idx));
+            }
+            
+            if (i % checkInterval == 0)
+            {
+                if ((i / checkInterval) % 2 == 0) index.flush();
+                
+                check(index, model);
+                
+                std::cout << "stress: " << i << " ops, size " << model.size() << std::endl;
+            }
+        }
+        
+        index.flush();
+        check(index, model);
+    }
+    
+    //compares every element.
+    template<class Index, typename Value>
+    static void check(Index& index, DDImplicitTreap<Value>& model)
+    {
+        assert(index.size() == model.size());
+        
+        model.forEach([&index](size_t idx, const Value& value)
+        {
+            assert(index.get((unsigned int)idx) == value);
+        });
+    }
 
     
 //
@@ -44,6 +44,22 @@ int main(int argc, const char * argv[])
     //values for consistency.
     //Tests::testAssertConfig();
     
+    //runs tens of millions of random operations against a reference
+    //model and compares all values periodically.
+    //Tests::testDifferentialStress();
+    
+    //checks the index modes against a reference model.
+    Tests::testDirectValues();
+    Tests::testStagedValues();
+    Tests::testSpill();
+    Tests::testReclustering();
+    Tests::testLevels();
+    Tests::testPipeline();
+    Tests::testSharedReads();
+    
+    //stops a merge after its journal commit and reopens the index.
+    Tests::testJournalReplay();
+    
     //runs the different benchmarks in random order and prints out the
     //results
     Tests::testBenchmarks();